@@ -0,0 +1,197 @@
+/*
+ * Event log decoder.  See ../include/events.h for the runbin frames and
+ * ../src/events.cpp for the packed event records.
+ *
+ * Reads the serial stream, from the Mega or from sequencer_host -b, and
+ * for each run sent whole prints a timeline, or with -c CSV lines.
+ * Event names come from event_names.h, the table the sequencer prints
+ * with.  Console text and other frames are skipped.
+ *
+ * Usage: event_decode [-c] [-r] [file]
+ *	-c	CSV instead of a timeline
+ *	-r	print pressures as filter_a instead of ADC counts
+ *
+ * CSV columns:
+ *	run, time_ms, code, event, param, ig_pressure, main_press, outputs
+ * The last three are empty for events without a snapshot.  outputs is
+ * the bitmap in hex, bit i for outputs[i].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "state_machine.h"	// ANALOG_FILTER_SCALE
+#include "telemetry.h"
+#include "events.h"
+#include "event_names.h"
+#include "frames.h"
+
+#define	N_NAMES		(sizeof (event_code_names) / sizeof (event_code_names[0]))
+
+static bool csv, raw;
+static unsigned long runs, incomplete;
+
+/*
+ * The run being received.
+ */
+static struct run_hdr hdr;
+static unsigned char *data;
+static unsigned int got;		// bytes of data, in order
+static bool receiving;
+
+static double pressure(unsigned int v)
+{
+	return raw? v: (double)v / ANALOG_FILTER_SCALE;
+}
+
+static void print_run()
+{
+	unsigned int rd, k, param, ig, main, outs, n;
+	unsigned char b, plen, shift;
+	unsigned char snap[EVENT_SNAP_BYTES];
+	unsigned long t, us, prev_us;
+	uint16_t crc;
+	const char *name;
+	char fallback[16];
+
+	crc = crc16(crc16(CRC16_INIT, &hdr, offsetof(struct run_hdr, crc)), data, hdr.len);
+	if (!csv) {
+		printf("Run %u: %u events", hdr.seqn, hdr.n_events);
+		if (hdr.n_dropped)
+			printf(" (%u dropped)", hdr.n_dropped);
+		printf(", abort %u, zero %u/%u, %s\n", hdr.abort_code,
+			hdr.zero_ig, hdr.zero_main, (crc == hdr.crc)? "CRC ok": "CRC BAD");
+		printf("%10s %10s  event\n", "ms", "+ms");
+	} else if (crc != hdr.crc)
+		fprintf(stderr, "run %u: CRC BAD\n", hdr.seqn);
+
+	us = prev_us = 0;
+	rd = 0;
+	for (n = 0; n < hdr.n_events && rd < hdr.len; n++) {
+		b = data[rd++];
+		t = 0;
+		shift = 0;
+		do {
+			k = data[rd++];
+			if (shift < 32)
+				t |= (unsigned long)(k & 0x7f) << shift;
+			shift += 7;
+		} while ((k & 0x80) && rd < hdr.len);
+		us += t * 4;
+
+		plen = b >> EVENT_PLEN_SHIFT;
+		for (k = 0; k < (plen == EVENT_SNAP? EVENT_SNAP_BYTES: plen) && rd < hdr.len; k++)
+			snap[k] = data[rd++];
+		param = 0;
+		for (k = 0; k < (plen == EVENT_SNAP? 2: plen); k++)
+			param |= (unsigned int)snap[k] << (8 * k);
+
+		if ((b & EVENT_CODE_MASK) < N_NAMES)
+			name = event_code_names[b & EVENT_CODE_MASK];
+		else {
+			snprintf(fallback, sizeof (fallback), "code %u", b & EVENT_CODE_MASK);
+			name = fallback;
+		}
+		ig = snap[2] | (snap[3] & 0xf) << 8;
+		main = snap[3] >> 4 | snap[4] << 4;
+		outs = snap[5] | snap[6] << 8;
+
+		if (csv) {
+			printf("%u,%.3f,%u,\"%s\",%u,", hdr.seqn, us / 1000.0,
+				b & EVENT_CODE_MASK, name, param);
+			if (plen == EVENT_SNAP)
+				printf("%g,%g,%04x\n", pressure(ig), pressure(main), outs);
+			else
+				printf(",,\n");
+			continue;
+		}
+		printf("%10.3f %+10.3f  %s  %u", us / 1000.0, (us - prev_us) / 1000.0,
+			name, param);
+		if (plen == EVENT_SNAP)
+			printf("  ig %g main %g out %04x", pressure(ig), pressure(main), outs);
+		printf("\n");
+		prev_us = us;
+	}
+	if (!csv)
+		printf("\n");
+}
+
+static bool frame(const unsigned char *buf, int len)
+{
+	unsigned int seqn, offset;
+
+	switch (buf[0]) {
+	    case TM_LOG_HDR:
+		if (len != 1 + (int)sizeof (hdr))
+			return false;
+		if (receiving)
+			incomplete++;
+		memcpy(&hdr, buf + 1, sizeof (hdr));
+		free(data);
+		data = (unsigned char *)malloc(hdr.len);
+		got = 0;
+		receiving = true;
+		return true;
+	    case TM_LOG_DATA:
+		if (len < 5)
+			return false;
+		seqn = get16(buf + 1);
+		offset = get16(buf + 3);
+		if (!receiving || seqn != hdr.seqn)
+			return true;
+		if (offset != got || got + len - 5 > hdr.len) {
+			incomplete++;	// lost a frame
+			receiving = false;
+			return true;
+		}
+		memcpy(data + got, buf + 5, len - 5);
+		got += len - 5;
+		if (got == hdr.len) {
+			print_run();
+			runs++;
+			receiving = false;
+		}
+		return true;
+	    case TM_SAMPLE:
+	    case TM_STATE:
+		return true;	// for telem_decode
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	FILE *f = stdin;
+	unsigned long skipped;
+
+	while ((opt = getopt(argc, argv, "cr")) != -1) {
+		switch (opt) {
+		    case 'c': csv = true; break;
+		    case 'r': raw = true; break;
+		    default:
+			fprintf(stderr, "usage: %s [-c] [-r] [file]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		f = fopen(argv[optind], "rb");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	if (csv)
+		printf("run,time_ms,code,event,param,ig_pressure,main_press,outputs\n");
+	skipped = read_frames(f, frame);
+	if (receiving)
+		incomplete++;
+
+	fprintf(stderr, "%lu runs, %lu incomplete, %lu other chunks skipped\n",
+		runs, incomplete, skipped);
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Reading telemetry frames, for the host decoders.  See
+ * ../include/telemetry.h for the framing.
+ *
+ * read_frames() splits the stream on 0x00, COBS decodes each piece and
+ * checks its CRC.  Good frames go to the callback without the CRC; it
+ * returns false for a frame it does not understand.  Console text
+ * between frames, damaged frames and frames not understood are counted
+ * as skipped.
+ */
+
+#ifndef frames_h
+#define frames_h
+
+#include <stdio.h>
+#include <stddef.h>
+#include "crc16.h"
+
+#define	MAX_FRAME	256
+
+typedef bool (*frame_fn)(const unsigned char *body, int len);
+
+/*
+ * COBS decode in place.  Returns the decoded length, or -1 if the
+ * frame is malformed.
+ */
+static int cobs_decode(unsigned char *buf, size_t n)
+{
+	size_t in = 0, out = 0;
+	unsigned char code, i;
+
+	while (in < n) {
+		code = buf[in++];
+		if (code == 0 || in + code - 1 > n)
+			return -1;
+		for (i = 1; i < code; i++)
+			buf[out++] = buf[in++];
+		if (code != 0xff && in < n)
+			buf[out++] = 0;
+	}
+	return out;
+}
+
+static inline unsigned int get16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static bool frame_check(unsigned char *buf, size_t n, frame_fn fn)
+{
+	int len;
+
+	len = cobs_decode(buf, n);
+	if (len < 3 || crc16(CRC16_INIT, buf, len - 2) != get16(buf + len - 2))
+		return false;
+	return fn(buf, len - 2);
+}
+
+/*
+ * Returns the number of chunks skipped.
+ */
+static unsigned long read_frames(FILE *f, frame_fn fn)
+{
+	unsigned char buf[MAX_FRAME];
+	unsigned long skipped = 0;
+	size_t n = 0;
+	bool overflow = false;
+	int c;
+
+	while ((c = getc(f)) != EOF) {
+		if (c != 0) {
+			if (n < sizeof (buf))
+				buf[n++] = c;
+			else
+				overflow = true;
+			continue;
+		}
+		if (n > 0 && (overflow || !frame_check(buf, n, fn)))
+			skipped++;	// long console text, or a bad frame
+		n = 0;
+		overflow = false;
+	}
+	return skipped;
+}
+
+#endif
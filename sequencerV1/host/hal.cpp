@@ -0,0 +1,381 @@
+/*
+ * Host implementation of the Arduino core, EEPROM and TFT stand-ins.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Adafruit_ST7735.h"
+#include "host.h"
+#include "spark.h"
+
+/*
+ * Virtual clock
+ */
+uint64_t host_now_us;
+bool host_model_costs = true;
+
+void host_advance_us(uint32_t us)
+{
+	host_now_us += us;
+}
+
+unsigned long millis()
+{
+	return (uint32_t)(host_now_us / 1000);
+}
+
+unsigned long micros()
+{
+	return (uint32_t)host_now_us;
+}
+
+void delay(unsigned long ms)
+{
+	host_advance_us(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	host_advance_us(us);
+}
+
+void noInterrupts() {}
+void interrupts() {}
+
+/*
+ * Pins.
+ * Inputs with a pullup read HIGH until the driver says otherwise.
+ */
+static uint8_t pin_in[NUM_DIGITAL_PINS];
+static uint8_t pin_out[NUM_DIGITAL_PINS];
+static bool pin_driven[NUM_DIGITAL_PINS];
+static int adc[16];
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	if (pin >= NUM_DIGITAL_PINS)
+		return;
+	if (mode == INPUT_PULLUP && !pin_driven[pin])
+		pin_in[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	if (pin < NUM_DIGITAL_PINS)
+		pin_out[pin] = val? HIGH: LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+	if (pin >= NUM_DIGITAL_PINS)
+		return LOW;
+	return pin_in[pin];
+}
+
+int analogRead(uint8_t pin)
+{
+	if (pin >= A0)
+		pin -= A0;
+	if (host_model_costs)
+		host_advance_us(HOST_ANALOG_READ_US);
+	return (pin < 16)? adc[pin]: 0;
+}
+
+void (*host_pin_hook)(uint8_t pin);
+
+void host_set_digital(uint8_t pin, uint8_t level)
+{
+	uint8_t was;
+
+	if (pin >= NUM_DIGITAL_PINS)
+		return;
+	was = pin_in[pin];
+	pin_in[pin] = level? HIGH: LOW;
+	pin_driven[pin] = true;
+	if (host_pin_hook != NULL && pin_in[pin] != was)
+		host_pin_hook(pin);
+}
+
+void host_set_analog(uint8_t pin, int counts)
+{
+	if (pin >= A0)
+		pin -= A0;
+	if (pin < 16)
+		adc[pin] = constrain(counts, 0, 1023);
+}
+
+int host_adc(uint8_t pin)
+{
+	if (pin >= A0)
+		pin -= A0;
+	return (pin < 16)? adc[pin]: 0;
+}
+
+uint8_t host_get_output(uint8_t pin)
+{
+	return (pin < NUM_DIGITAL_PINS)? pin_out[pin]: LOW;
+}
+
+/*
+ * Print
+ */
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = 0;
+
+	while (size--)
+		n += write(*buffer++);
+	return n;
+}
+
+size_t Print::printNumber(unsigned long n, int base)
+{
+	char buf[8 * sizeof (long) + 1];
+	char *str = &buf[sizeof (buf) - 1];
+
+	if (base < 2)
+		base = 10;
+	*str = '\0';
+	do {
+		char c = n % base;
+		n /= base;
+		*--str = c < 10? c + '0': c + 'A' - 10;
+	} while (n);
+	return write(str);
+}
+
+size_t Print::print(const __FlashStringHelper *s) { return write((const char *)s); }
+size_t Print::print(const char s[]) { return write(s); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(unsigned char n, int base) { return printNumber(n, base); }
+size_t Print::print(int n, int base) { return print((long)n, base); }
+size_t Print::print(unsigned int n, int base) { return printNumber(n, base); }
+size_t Print::print(unsigned long n, int base) { return printNumber(n, base); }
+
+size_t Print::print(long n, int base)
+{
+	if (base == 10 && n < 0)
+		return write('-') + printNumber(-n, 10);
+	return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof (buf), "%.*f", digits, n);
+	return write(buf);
+}
+
+size_t Print::println(void) { return write("\r\n"); }
+size_t Print::println(const __FlashStringHelper *s) { return print(s) + println(); }
+size_t Print::println(const char s[]) { return print(s) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char n, int base) { return print(n, base) + println(); }
+size_t Print::println(int n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned int n, int base) { return print(n, base) + println(); }
+size_t Print::println(long n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned long n, int base) { return print(n, base) + println(); }
+size_t Print::println(double n, int digits) { return print(n, digits) + println(); }
+
+/*
+ * SD card image, see sd_card.cpp
+ */
+const char *host_sd_image;
+
+/*
+ * Serial console
+ */
+HardwareSerial Serial;
+bool host_serial_quiet;
+bool host_serial_raw;		// keep '\r', for binary telemetry
+
+#define	HOST_RX_SIZE	4096
+static char rx_buf[HOST_RX_SIZE];
+static unsigned int rx_head, rx_tail;
+
+void host_serial_input(const char *s)
+{
+	while (*s) {
+		unsigned int next = (rx_head + 1) % HOST_RX_SIZE;
+		if (next == rx_tail)
+			return;		// overrun, same as the real UART
+		rx_buf[rx_head] = *s++;
+		rx_head = next;
+	}
+}
+
+/*
+ * Transmit timing.  Characters leave at one per character time; once
+ * HOST_SERIAL_TX_BUFFER of them are queued, write() waits for a slot,
+ * as HardwareSerial does.
+ */
+static uint32_t tx_char_us = 1042;	// 10 bits at 9600 baud
+static uint64_t tx_done_us;		// when the last queued character is out
+
+void HardwareSerial::begin(unsigned long baud)
+{
+	if (baud)
+		tx_char_us = (10000000UL + baud / 2) / baud;
+}
+
+int HardwareSerial::available()
+{
+	return (rx_head + HOST_RX_SIZE - rx_tail) % HOST_RX_SIZE;
+}
+
+int HardwareSerial::peek()
+{
+	return (rx_head == rx_tail)? -1: (unsigned char)rx_buf[rx_tail];
+}
+
+int HardwareSerial::read()
+{
+	int c = peek();
+
+	if (c >= 0)
+		rx_tail = (rx_tail + 1) % HOST_RX_SIZE;
+	return c;
+}
+
+int HardwareSerial::availableForWrite()
+{
+	uint64_t queued;
+
+	if (!host_model_costs || tx_done_us <= host_now_us)
+		return HOST_SERIAL_TX_BUFFER - 1;
+	queued = (tx_done_us - host_now_us + tx_char_us - 1) / tx_char_us;
+	return (queued >= HOST_SERIAL_TX_BUFFER - 1)? 0: HOST_SERIAL_TX_BUFFER - 1 - queued;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	uint64_t full_until;
+
+	if (host_model_costs) {
+		if (tx_done_us < host_now_us)
+			tx_done_us = host_now_us;
+		full_until = tx_done_us - (uint64_t)HOST_SERIAL_TX_BUFFER * tx_char_us;
+		if (tx_done_us >= (uint64_t)HOST_SERIAL_TX_BUFFER * tx_char_us &&
+		    full_until > host_now_us)
+			host_now_us = full_until;
+		tx_done_us += tx_char_us;
+	}
+	if ((c != '\r' || host_serial_raw) && !host_serial_quiet)
+		putchar(c);
+	return 1;
+}
+
+/*
+ * EEPROM.  Erased state is all ones, as on a fresh chip.
+ */
+uint8_t host_eeprom[HOST_EEPROM_SIZE];
+EEPROMClass EEPROM;
+
+void host_eeprom_write(int idx, uint8_t val)
+{
+	if (idx < 0 || idx >= HOST_EEPROM_SIZE)
+		return;
+	host_eeprom[idx] = val;
+	if (host_model_costs)
+		host_advance_us(HOST_EEPROM_WRITE_US);
+}
+
+static struct eeprom_erase {
+	eeprom_erase() { memset(host_eeprom, 0xff, sizeof (host_eeprom)); }
+} eeprom_erase_at_startup;
+
+/*
+ * TFT.  Drawing is discarded, cost is charged per pixel touched.
+ */
+static void tft_charge(long pixels)
+{
+	if (host_model_costs && pixels > 0)
+		host_advance_us((uint32_t)(pixels * HOST_TFT_NS_PER_PIXEL / 1000));
+}
+
+Adafruit_GFX::Adafruit_GFX(int16_t w, int16_t h) :
+	WIDTH(w), HEIGHT(h), _width(w), _height(h), cursor_x(0), cursor_y(0),
+	textcolor(0xffff), textbgcolor(0xffff), textsize(1), rotation(0), wrap(true)
+{
+}
+
+void Adafruit_GFX::setRotation(uint8_t r)
+{
+	rotation = r & 3;
+	if (rotation & 1) {
+		_width = HEIGHT;
+		_height = WIDTH;
+	} else {
+		_width = WIDTH;
+		_height = HEIGHT;
+	}
+}
+
+void Adafruit_GFX::fillScreen(uint16_t color)
+{
+	fillRect(0, 0, _width, _height, color);
+}
+
+void Adafruit_GFX::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+	(void)color;
+	if (x < 0) { w += x; x = 0; }
+	if (y < 0) { h += y; y = 0; }
+	if (x + w > _width) w = _width - x;
+	if (y + h > _height) h = _height - y;
+	if (w > 0 && h > 0)
+		tft_charge((long)w * h);
+}
+
+void Adafruit_GFX::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+	(void)color;
+	if (x >= 0 && y >= 0 && x < _width && y < _height)
+		tft_charge(1);
+}
+
+size_t Adafruit_GFX::write(uint8_t c)
+{
+	if (c == '\n') {
+		cursor_x = 0;
+		cursor_y += textsize * 8;
+	} else if (c != '\r') {
+		// A 5x7 glyph in a 6x8 cell.  Only set pixels are sent,
+		// unless a background color is in use.
+		tft_charge((long)((textcolor == textbgcolor)? 20: 48) * textsize * textsize);
+		cursor_x += textsize * 6;
+	}
+	return 1;
+}
+
+Adafruit_ST7735::Adafruit_ST7735(int8_t cs, int8_t dc, int8_t rst) :
+	Adafruit_GFX(ST7735_TFTWIDTH, ST7735_TFTHEIGHT)
+{
+	(void)cs; (void)dc; (void)rst;
+}
+
+Adafruit_ST7735::Adafruit_ST7735(int8_t cs, int8_t dc, int8_t mosi, int8_t sclk, int8_t rst) :
+	Adafruit_GFX(ST7735_TFTWIDTH, ST7735_TFTHEIGHT)
+{
+	(void)cs; (void)dc; (void)mosi; (void)sclk; (void)rst;
+}
+
+void Adafruit_ST7735::initR(uint8_t options)
+{
+	(void)options;
+}
+
+/*
+ * The target panic routine spins forever with the red LED on.
+ * On the host we would rather stop.
+ */
+void myPanic(const char *msg)
+{
+	spark_stop();
+	fflush(stdout);
+	fprintf(stderr, "PANIC: %s at %lu ms\n", msg, millis());
+	exit(2);
+}
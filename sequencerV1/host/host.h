@@ -0,0 +1,69 @@
+/*
+ * Driver-side interface to the host HAL.
+ *
+ * The sketch only ever sees the Arduino API.  The host driver uses
+ * these routines to move the virtual clock, to set what the pins and
+ * the ADC read, and to feed the serial console.
+ */
+
+#ifndef host_h
+#define host_h
+
+#include <stdint.h>
+
+/*
+ * Virtual time, in microseconds since power up.
+ */
+extern uint64_t host_now_us;
+void host_advance_us(uint32_t us);
+
+/*
+ * When true, calls that take real time on the Mega (analogRead, TFT
+ * drawing, delay) advance the virtual clock by about what they cost
+ * on target.  When false they are free.
+ */
+extern bool host_model_costs;
+
+#define	HOST_ANALOG_READ_US	112	// one conversion at the default ADC prescaler
+#define	HOST_TFT_NS_PER_PIXEL	4800	// fillScreen() of 160x128 takes ~100 ms
+#define	HOST_EEPROM_WRITE_US	3300	// one EEPROM byte erase and write
+#define	HOST_SERIAL_TX_BUFFER	SERIAL_TX_BUFFER_SIZE	// HardwareSerial TX ring; writes block when full
+#define	HOST_SD_XFER_US		800	// one SD block over SPI at 8 MHz
+#define	HOST_SD_BUSY_US		2000	// the card programming it, a typical card
+
+/*
+ * Pin levels seen by digitalRead() and analogRead(), and the levels
+ * last written by digitalWrite().
+ */
+void host_set_digital(uint8_t pin, uint8_t level);
+void host_set_analog(uint8_t pin, int counts);
+uint8_t host_get_output(uint8_t pin);
+
+/*
+ * If set, called by host_set_digital() when a pin changes, as a pin
+ * change interrupt would be.  Set by pin_capture_start().
+ */
+extern void (*host_pin_hook)(uint8_t pin);
+
+/*
+ * What the ADC converts on a pin, without charging for the conversion.
+ * Used by the host side of the ADC sampler.
+ */
+int host_adc(uint8_t pin);
+
+/*
+ * Serial console.  Input is queued and read by the sketch one
+ * character at a time.  Output goes to stdout unless quiet.
+ */
+void host_serial_input(const char *s);
+extern bool host_serial_quiet;
+extern bool host_serial_raw;
+
+/*
+ * SD card image file, NULL for no card.  A new image gets
+ * HOST_SD_BLOCKS blocks; an existing one keeps its size.
+ */
+#define	HOST_SD_BLOCKS	4096	// 2 MB
+extern const char *host_sd_image;
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Host stand-in for the Adafruit GFX core.
+ *
+ * Nothing is drawn.  Each drawing call optionally charges the virtual
+ * clock with roughly what the real SPI transfer costs, so that the
+ * host build shows where screen updates stall the control loop.
+ */
+
+#ifndef _ADAFRUIT_GFX_H
+#define _ADAFRUIT_GFX_H
+
+#include "Arduino.h"
+
+class Adafruit_GFX : public Print {
+public:
+	Adafruit_GFX(int16_t w, int16_t h);
+
+	void fillScreen(uint16_t color);
+	void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+	void drawPixel(int16_t x, int16_t y, uint16_t color);
+	void setCursor(int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+	void setTextColor(uint16_t c) { textcolor = textbgcolor = c; }
+	void setTextColor(uint16_t c, uint16_t bg) { textcolor = c; textbgcolor = bg; }
+	void setTextSize(uint8_t s) { textsize = (s > 0)? s: 1; }
+	void setTextWrap(bool w) { wrap = w; }
+	void setRotation(uint8_t r);
+	int16_t width() const { return _width; }
+	int16_t height() const { return _height; }
+
+	size_t write(uint8_t c);
+	using Print::write;
+
+protected:
+	int16_t WIDTH, HEIGHT;
+	int16_t _width, _height;
+	int16_t cursor_x, cursor_y;
+	uint16_t textcolor, textbgcolor;
+	uint8_t textsize;
+	uint8_t rotation;
+	bool wrap;
+};
+
+#endif
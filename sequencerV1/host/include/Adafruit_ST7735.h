@@ -0,0 +1,33 @@
+/*
+ * Host stand-in for the Adafruit ST7735 driver.
+ */
+
+#ifndef _ADAFRUIT_ST7735H_
+#define _ADAFRUIT_ST7735H_
+
+#include "Adafruit_GFX.h"
+
+#define	INITR_GREENTAB	0x0
+#define	INITR_REDTAB	0x1
+#define	INITR_BLACKTAB	0x2
+
+#define	ST7735_TFTWIDTH		128
+#define	ST7735_TFTHEIGHT	160
+
+#define	ST7735_BLACK	0x0000
+#define	ST7735_BLUE	0x001F
+#define	ST7735_RED	0xF800
+#define	ST7735_GREEN	0x07E0
+#define	ST7735_CYAN	0x07FF
+#define	ST7735_MAGENTA	0xF81F
+#define	ST7735_YELLOW	0xFFE0
+#define	ST7735_WHITE	0xFFFF
+
+class Adafruit_ST7735 : public Adafruit_GFX {
+public:
+	Adafruit_ST7735(int8_t cs, int8_t dc, int8_t rst);
+	Adafruit_ST7735(int8_t cs, int8_t dc, int8_t mosi, int8_t sclk, int8_t rst);
+	void initR(uint8_t options = INITR_GREENTAB);
+};
+
+#endif
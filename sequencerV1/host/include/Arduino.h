@@ -0,0 +1,138 @@
+/*
+ * Host (Linux) stand-in for the Arduino core.
+ *
+ * Only the parts of the Arduino API that the sequencer actually uses
+ * are provided.  Time is virtual: millis() and micros() read a clock
+ * that the host driver advances, so loop() can be run as fast as the
+ * workstation allows while the sketch still sees a sane time base.
+ *
+ * The pin level, ADC and serial implementations live in hal.cpp.
+ * The driver side of the interface is in host.h.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "avr/pgmspace.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef uint16_t word;
+
+#define	HIGH		1
+#define	LOW		0
+
+#define	INPUT		0
+#define	OUTPUT		1
+#define	INPUT_PULLUP	2
+
+#define	DEC		10
+#define	HEX		16
+#define	OCT		8
+#define	BIN		2
+
+/*
+ * Arduino Mega analog pin numbers.
+ */
+#define	A0	54
+#define	A1	55
+#define	A2	56
+#define	A3	57
+#define	A4	58
+#define	A5	59
+#define	A6	60
+#define	A7	61
+#define	A8	62
+#define	A9	63
+#define	A10	64
+#define	A11	65
+#define	A12	66
+#define	A13	67
+#define	A14	68
+#define	A15	69
+
+#define	NUM_DIGITAL_PINS	70
+#define	F_CPU		16000000UL
+
+#ifndef min
+#define min(a,b) ((a)<(b)?(a):(b))
+#endif
+#ifndef max
+#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void noInterrupts();
+void interrupts();
+
+/*
+ * Print / Serial, following the Arduino class layout so that
+ * tft.print() and Serial.print() resolve the same way they do on target.
+ */
+class __FlashStringHelper;
+#define	F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	size_t write(const char *str) { return str? write((const uint8_t *)str, strlen(str)): 0; }
+
+	size_t print(const __FlashStringHelper *s);
+	size_t print(const char s[]);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	size_t println(const __FlashStringHelper *s);
+	size_t println(const char s[]);
+	size_t println(char c);
+	size_t println(unsigned char n, int base = DEC);
+	size_t println(int n, int base = DEC);
+	size_t println(unsigned int n, int base = DEC);
+	size_t println(long n, int base = DEC);
+	size_t println(unsigned long n, int base = DEC);
+	size_t println(double n, int digits = 2);
+	size_t println(void);
+
+private:
+	size_t printNumber(unsigned long n, int base);
+};
+
+#define	SERIAL_TX_BUFFER_SIZE	64	// as the AVR core
+
+class HardwareSerial : public Print {
+public:
+	void begin(unsigned long baud);
+	int available();
+	int read();
+	int peek();
+	int availableForWrite();
+	void flush() {}
+	size_t write(uint8_t c);
+	using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Host stand-in for the Arduino EEPROM library.
+ * Backed by a RAM array the size of the ATmega2560 EEPROM.
+ * Out of range accesses are dropped (writes) or read as 0xff.
+ * Each byte written charges the virtual clock, see hal.cpp.
+ */
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+
+#define	HOST_EEPROM_SIZE	4096
+
+extern uint8_t host_eeprom[HOST_EEPROM_SIZE];
+void host_eeprom_write(int idx, uint8_t val);
+
+class EEPROMClass {
+public:
+	uint8_t read(int idx) { return (idx >= 0 && idx < HOST_EEPROM_SIZE)? host_eeprom[idx]: 0xff; }
+	void write(int idx, uint8_t val) { host_eeprom_write(idx, val); }
+	void update(int idx, uint8_t val) { if (read(idx) != val) write(idx, val); }
+	uint16_t length() { return HOST_EEPROM_SIZE; }
+
+	template <class T> T &get(int idx, T &t) {
+		uint8_t *p = (uint8_t *)&t;
+		for (unsigned int i = 0; i < sizeof (T); i++)
+			p[i] = read(idx + i);
+		return t;
+	}
+
+	template <class T> const T &put(int idx, const T &t) {
+		const uint8_t *p = (const uint8_t *)&t;
+		for (unsigned int i = 0; i < sizeof (T); i++)
+			write(idx + i, p[i]);
+		return t;
+	}
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for the Arduino Servo library.
+ * Remembers the commanded position so the driver can report it.
+ */
+
+#ifndef Servo_h
+#define Servo_h
+
+#include <stdint.h>
+
+class Servo {
+public:
+	Servo() : pin(0), pos(0), is_attached(false) {}
+	uint8_t attach(int p) { pin = p; is_attached = true; return 0; }
+	void detach() { is_attached = false; }
+	void write(int value) { pos = value; }
+	int read() { return pos; }
+	bool attached() { return is_attached; }
+
+private:
+	int pin;
+	int pos;
+	bool is_attached;
+};
+
+#endif
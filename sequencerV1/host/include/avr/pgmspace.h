@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for avr/pgmspace.h.
+ * There is only one address space on the host, so program memory
+ * accessors are plain reads.
+ */
+
+#ifndef pgmspace_h
+#define pgmspace_h
+
+#include <string.h>
+
+#define	PROGMEM
+#define	PGM_P		const char *
+
+#define	pgm_read_byte(addr)	(*(const unsigned char *)(addr))
+#define	pgm_read_word(addr)	(*(addr))
+#define	pgm_read_dword(addr)	(*(addr))
+#define	pgm_read_ptr(addr)	(*(addr))
+
+#define	strcpy_P(dst, src)	strcpy((dst), (src))
+#define	strncpy_P(dst, src, n)	strncpy((dst), (src), (n))
+#define	strcmp_P(a, b)		strcmp((a), (b))
+#define	strlen_P(s)		strlen((s))
+#define	memcpy_P(dst, src, n)	memcpy((dst), (src), (n))
+
+#endif
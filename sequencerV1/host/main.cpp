@@ -0,0 +1,278 @@
+/*
+ * Host driver for the sequencer.
+ *
+ * Runs setup() once and then loop() until told to stop, moving the
+ * virtual clock along as it goes.  Input changes and console commands
+ * come from a scenario file.  At the end a table of per-state loop cost
+ * is printed: wall clock time on this machine, and virtual time as the
+ * Mega would have seen it.
+ *
+ * Usage: sequencer_host [-n loops] [-t ms] [-s step_us] [-d image] [-c] [-q] [-b] [-v] [scenario]
+ *	-n	stop after this many loops
+ *	-t	stop at this virtual time in milliseconds
+ *	-s	virtual microseconds charged per loop on top of modelled costs
+ *	-d	SD card image, created if missing; without -d there is no card
+ *	-c	do not model analogRead / TFT / delay costs
+ *	-q	discard serial console output
+ *	-b	pass serial output through byte for byte (for telem_decode)
+ *	-v	print state transitions with their virtual time
+ *
+ * Scenario file lines, times in virtual milliseconds, in increasing order:
+ *	<ms> d <pin> <0|1>		set a digital input level
+ *	<ms> a <pin> <counts>		set an analog input (pin may be A0..A15)
+ *	<ms> s <text>			type a console line
+ *	<ms> expect <state name>	fail unless this is the current state
+ *	<ms> end			stop
+ * Blank lines and lines starting with '#' are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "state_machine.h"
+#include "host.h"
+
+void setup();
+void loop();
+
+#define	MAX_STATES	64
+#define	MAX_SCRIPT	1024
+
+struct state_cost {
+	const struct state *s;
+	unsigned long loops;
+	uint64_t wall_ns;
+	uint64_t virt_us;
+	uint32_t virt_max_us;
+};
+
+static struct state_cost costs[MAX_STATES];
+static int n_costs;
+
+enum script_op { op_digital, op_analog, op_serial, op_expect, op_end };
+
+struct script_line {
+	unsigned long t_ms;
+	enum script_op op;
+	int pin;
+	int value;
+	char text[64];
+};
+
+static struct script_line script[MAX_SCRIPT];
+static int n_script;
+
+static uint64_t wall_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct state_cost *cost_for(const struct state *s)
+{
+	int i;
+
+	for (i = 0; i < n_costs; i++)
+		if (costs[i].s == s)
+			return costs + i;
+	if (n_costs >= MAX_STATES)
+		return NULL;
+	costs[n_costs].s = s;
+	return costs + n_costs++;
+}
+
+static int parse_pin(const char *p)
+{
+	if (p[0] == 'A' || p[0] == 'a')
+		return A0 + atoi(p + 1);
+	return atoi(p);
+}
+
+static void load_script(const char *fname)
+{
+	FILE *f;
+	char line[128];
+	char op[16], arg[64];
+	int lineno = 0;
+	struct script_line *l;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		perror(fname);
+		exit(1);
+	}
+	while (fgets(line, sizeof (line), f)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == 0 || line[0] == '#')
+			continue;
+		if (n_script >= MAX_SCRIPT) {
+			fprintf(stderr, "%s: too many lines\n", fname);
+			exit(1);
+		}
+		l = script + n_script;
+		memset(l, 0, sizeof (*l));
+		if (sscanf(line, "%lu %15s", &l->t_ms, op) != 2)
+			goto bad;
+		if (strcmp(op, "d") == 0 || strcmp(op, "a") == 0) {
+			if (sscanf(line, "%*u %*s %63s %d", arg, &l->value) != 2)
+				goto bad;
+			l->pin = parse_pin(arg);
+			l->op = (op[0] == 'd')? op_digital: op_analog;
+		} else if (strcmp(op, "s") == 0 || strcmp(op, "expect") == 0) {
+			const char *p = strstr(line, op) + strlen(op);
+			while (*p == ' ' || *p == '\t')
+				p++;
+			strncpy(l->text, p, sizeof (l->text) - 2);
+			l->op = (op[0] == 's')? op_serial: op_expect;
+		} else if (strcmp(op, "end") == 0) {
+			l->op = op_end;
+		} else
+			goto bad;
+		n_script++;
+	}
+	fclose(f);
+	return;
+bad:
+	fprintf(stderr, "%s:%d: cannot parse \"%s\"\n", fname, lineno, line);
+	exit(1);
+}
+
+/*
+ * Apply all script lines that are due.
+ * Returns false when the run should stop.
+ */
+static int script_next;
+static int failures;
+
+static bool run_script()
+{
+	struct script_line *l;
+	char buf[72];
+
+	while (script_next < n_script && script[script_next].t_ms <= millis()) {
+		l = script + script_next++;
+		switch (l->op) {
+		    case op_digital:
+			host_set_digital(l->pin, l->value);
+			break;
+		    case op_analog:
+			host_set_analog(l->pin, l->value);
+			break;
+		    case op_serial:
+			snprintf(buf, sizeof (buf), "%s\n", l->text);
+			host_serial_input(buf);
+			break;
+		    case op_expect:
+			if (strcmp(current_state->name, l->text) != 0) {
+				fprintf(stderr, "%lu ms: expected state %s, in %s\n",
+					millis(), l->text, current_state->name);
+				failures++;
+			}
+			break;
+		    case op_end:
+			return false;
+		}
+	}
+	return true;
+}
+
+static void report(unsigned long loops, uint64_t total_ns)
+{
+	int i;
+	struct state_cost *c;
+
+	fprintf(stderr, "\n%lu loops, %.3f s wall, %.0f loops/s, %.3f s virtual\n",
+		loops, total_ns / 1e9, total_ns? loops / (total_ns / 1e9): 0.0,
+		host_now_us / 1e6);
+	fprintf(stderr, "%-24s %10s %10s %10s %10s\n",
+		"state", "loops", "wall ns", "virt us", "max us");
+	for (i = 0; i < n_costs; i++) {
+		c = costs + i;
+		fprintf(stderr, "%-24s %10lu %10.1f %10.1f %10lu\n",
+			c->s->name, c->loops,
+			(double)c->wall_ns / c->loops,
+			(double)c->virt_us / c->loops,
+			(unsigned long)c->virt_max_us);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	unsigned long max_loops = 0;
+	unsigned long max_ms = 0;
+	uint32_t step_us = 100;
+	bool trace_states = false;
+	unsigned long loops;
+	uint64_t t0, t1, total_ns;
+	uint64_t v0;
+	uint32_t dv;
+	const struct state *s;
+	struct state_cost *c;
+
+	while ((opt = getopt(argc, argv, "n:t:s:d:cqbv")) != -1) {
+		switch (opt) {
+		    case 'n': max_loops = strtoul(optarg, NULL, 0); break;
+		    case 't': max_ms = strtoul(optarg, NULL, 0); break;
+		    case 's': step_us = strtoul(optarg, NULL, 0); break;
+		    case 'd': host_sd_image = optarg; break;
+		    case 'c': host_model_costs = false; break;
+		    case 'q': host_serial_quiet = true; break;
+		    case 'b': host_serial_raw = true; break;
+		    case 'v': trace_states = true; break;
+		    default:
+			fprintf(stderr, "usage: %s [-n loops] [-t ms] [-s step_us] [-d image] [-c] [-q] [-b] [-v] [scenario]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		load_script(argv[optind]);
+	if (!max_loops && !max_ms && !n_script)
+		max_loops = 1000000;
+
+	run_script();
+	setup();
+
+	total_ns = 0;
+	for (loops = 0; !max_loops || loops < max_loops; loops++) {
+		if (max_ms && millis() >= max_ms)
+			break;
+		if (!run_script())
+			break;
+
+		s = current_state;
+		v0 = host_now_us;
+		t0 = wall_ns();
+		loop();
+		t1 = wall_ns();
+		host_advance_us(step_us);
+		dv = host_now_us - v0;
+
+		total_ns += t1 - t0;
+		c = cost_for(s);
+		if (c) {
+			c->loops++;
+			c->wall_ns += t1 - t0;
+			c->virt_us += dv;
+			if (dv > c->virt_max_us)
+				c->virt_max_us = dv;
+		}
+		if (trace_states && current_state != s)
+			fprintf(stderr, "%10.3f ms  %s -> %s\n",
+				v0 / 1000.0, s->name, current_state->name);
+	}
+
+	report(loops, total_ns);
+	if (failures) {
+		fprintf(stderr, "%d expectation(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
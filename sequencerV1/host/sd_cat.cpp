@@ -0,0 +1,98 @@
+/*
+ * SD card image reader.  See ../include/sd_log.h for the layout.
+ *
+ * With just the image, lists the files on it, oldest first.  With a
+ * file number, copies that file to stdout, for telem_decode or
+ * event_decode:
+ *	sd_cat card.img 3 | event_decode
+ * An image of a real card can be made with dd; sequencer_host -d
+ * writes one directly.
+ *
+ * Usage: sd_cat image [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sd_log.h"
+#include "crc16.h"
+
+struct extent {
+	unsigned int file;
+	unsigned long first;
+	unsigned long blocks;
+	unsigned long bytes;
+};
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	struct sdl_super sb;
+	struct sdl_blk h;
+	struct extent cur = {0, 0, 0, 0};
+	unsigned char data[SDL_DATA];
+	unsigned long n_blocks, start, i, lba, files;
+	long size;
+	int want = -1;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s image [file]\n", argv[0]);
+		return 1;
+	}
+	if (argc == 3)
+		want = atoi(argv[2]);
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	n_blocks = size / SD_BLOCK;
+	rewind(f);
+
+	start = 1;
+	if (fread(&sb, 1, sizeof (sb), f) != sizeof (sb) || sb.magic != SDL_MAGIC ||
+	    sb.crc != crc16(CRC16_INIT, &sb, offsetof(struct sdl_super, crc)))
+		fprintf(stderr, "%s: no super block, reading every block\n", argv[1]);
+	else if (sb.wrapped && sb.next < n_blocks)
+		start = sb.next;		// oldest block
+	else
+		sb.wrapped = 0;
+
+	if (want < 0)
+		printf("%6s %10s %8s %10s\n", "file", "first", "blocks", "bytes");
+	files = 0;
+	for (i = 0; i + 1 < n_blocks; i++) {
+		lba = start + i;
+		if (lba >= n_blocks)
+			lba -= n_blocks - 1;
+		fseek(f, lba * SD_BLOCK, SEEK_SET);
+		if (fread(&h, 1, sizeof (h), f) != sizeof (h))
+			break;
+		if (h.file == 0 || h.file == 0xffff || h.len > SDL_DATA)
+			continue;		// never written
+		if (h.file == want) {
+			if (fread(data, 1, h.len, f) != h.len)
+				break;
+			fwrite(data, 1, h.len, stdout);
+		}
+		if (h.file != cur.file) {
+			if (cur.file && want < 0)
+				printf("%6u %10lu %8lu %10lu\n", cur.file, cur.first, cur.blocks, cur.bytes);
+			cur.file = h.file;
+			cur.first = lba;
+			cur.blocks = 0;
+			cur.bytes = 0;
+			files++;
+		}
+		cur.blocks++;
+		cur.bytes += h.len;
+	}
+	if (cur.file && want < 0)
+		printf("%6u %10lu %8lu %10lu\n", cur.file, cur.first, cur.blocks, cur.bytes);
+	if (want < 0)
+		fprintf(stderr, "%lu files in %lu blocks\n", files, n_blocks);
+	return 0;
+}
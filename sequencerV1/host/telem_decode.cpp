@@ -0,0 +1,112 @@
+/*
+ * Telemetry decoder.  See ../include/telemetry.h for the frame format.
+ *
+ * Reads the serial stream, from the Mega or from sequencer_host -b, and
+ * writes one CSV line per sample frame.  Console text between frames
+ * and damaged frames are skipped.  Counts of those and of lost samples
+ * go to stderr at the end.
+ *
+ * Usage: telem_decode [-r] [file]
+ *	-r	print pressures as filter_a instead of ADC counts
+ *
+ * CSV columns:
+ *	seq, time_ms, state, outputs, ig_pressure, main_press, power_sense
+ * outputs is the bitmap in hex, bit i for outputs[i].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "state_machine.h"	// ANALOG_FILTER_SCALE
+#include "telemetry.h"
+#include "frames.h"
+
+#define	MAX_STATES	256
+
+static char *state_names[MAX_STATES];
+static bool raw;
+
+static unsigned long samples, lost, skipped;
+
+static double pressure(unsigned int v)
+{
+	return raw? v: (double)v / ANALOG_FILTER_SCALE;
+}
+
+static bool frame(const unsigned char *buf, int len)
+{
+	static bool have_seq;
+	static unsigned char next_seq;
+	unsigned char id;
+	const char *name;
+	char fallback[8];
+
+	switch (buf[0]) {
+	    case TM_STATE:
+		if (len < 3)
+			return false;
+		id = buf[2];
+		free(state_names[id]);
+		state_names[id] = strndup((const char *)buf + 3, len - 3);
+		return true;
+	    case TM_SAMPLE:
+		if (len != 15)
+			return false;
+		if (have_seq)
+			lost += (unsigned char)(buf[1] - next_seq);
+		have_seq = true;
+		next_seq = buf[1] + 1;
+		samples++;
+
+		id = buf[6];
+		name = state_names[id];
+		if (!name) {
+			snprintf(fallback, sizeof (fallback), "#%u", id);
+			name = fallback;
+		}
+		printf("%u,%.3f,%s,%04x,%g,%g,%g\n",
+			buf[1],
+			(get16(buf + 2) | (unsigned long)get16(buf + 4) << 16) / 1000.0,
+			name,
+			get16(buf + 7),
+			pressure(get16(buf + 9)),
+			pressure(get16(buf + 11)),
+			pressure(get16(buf + 13)));
+		return true;
+	    case TM_LOG_HDR:
+	    case TM_LOG_DATA:
+		return true;	// for event_decode
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	FILE *f = stdin;
+
+	while ((opt = getopt(argc, argv, "r")) != -1) {
+		switch (opt) {
+		    case 'r': raw = true; break;
+		    default:
+			fprintf(stderr, "usage: %s [-r] [file]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		f = fopen(argv[optind], "rb");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	printf("seq,time_ms,state,outputs,ig_pressure,main_press,power_sense\n");
+	skipped = read_frames(f, frame);
+
+	fprintf(stderr, "%lu samples, %lu lost, %lu other chunks skipped\n",
+		samples, lost, skipped);
+	return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Interrupt driven ADC sampler.
+ *
+ * The ADC converts the analog inputs one after another, round robin,
+ * for ever.  Each conversion takes ADC_CONV_US at the Arduino default
+ * prescaler, so with n channels each one is sampled every
+ * n * ADC_CONV_US (4 channels: 416 us, 2.4 kHz).
+ *
+ * The conversion complete interrupt stores each result in a two entry
+ * buffer for its channel and bumps the channel's 8 bit sequence count.
+ * Readers take the newest entry and check the count did not move
+ * under them, so they never see half of a 10 bit value.
+ *
+ * read_input() and the reada console command use the latest sample
+ * instead of calling analogRead(), which waited ~110 us per input.
+ * Nothing else may use the ADC while the sampler runs.
+ *
+ * A channel can be oversampled by ovs bits: 4^ovs conversions are
+ * summed and the sum shifted down by ovs, giving 10 + ovs bits, and
+ * that is its sample, 2^ovs times the ADC counts.  The extra bits are
+ * real as long as the input has an LSB or so of noise, which the
+ * pressure sensors do.  Oversampled channels get ADC_OVS_SLOTS turns
+ * for every one of the others: with the two pressures at 2 bits and
+ * two plain channels, a pass is 10 conversions, 1.04 ms, each pressure
+ * sample averages 16 conversions over 4.2 ms, and adc_delay_us() says
+ * it is about 4.2 ms behind when read.  The plain channels are still
+ * sampled every 1.04 ms.
+ *
+ * The conversion interrupt also scans the captured digital pins (see
+ * pin_capture.h), since it is the most frequent one there is.
+ */
+
+#ifndef adc_sampler_h
+#define adc_sampler_h
+
+#define	ADC_CONV_US	104	// 13 ADC clocks at 16 MHz / 128
+#define	ADC_OVS_MAX	2	// filter_a has room for 2 more bits, see state_machine.h
+#define	ADC_OVS_SLOTS	4	// turns per pass for an oversampled channel
+
+void adc_sampler_add(unsigned char pin, unsigned char ovs);
+void adc_sampler_start();
+int adc_sample(unsigned char pin, unsigned char *seq);
+unsigned char adc_ovs(unsigned char pin);
+unsigned long adc_delay_us(unsigned char pin);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Fixed rate control tick.
+ *
+ * Timer 2 interrupts every CONTROL_TICK_US.  loop() runs the control
+ * step (read_inputs, check_state, update_outputs) once per tick, and
+ * the console in between.  loop_start_t and loop_start_us are the
+ * scheduled time of the tick, not the time loop() got around to it,
+ * so a state that waits N ms from loop_start_t waits N ms to within
+ * one tick, whatever the previous step cost.
+ *
+ * A step that runs long (TFT erase, EEPROM commit) misses ticks.
+ * Missed ticks are not made up; the next step runs at the latest tick
+ * and loop_start_t jumps ahead.
+ *
+ * For each step we record how late it started relative to its tick,
+ * and how many ticks were missed before it.
+ *
+ * Console:
+ * 	tick			print tick rate, lateness and missed ticks
+ * 	tick reset		clear the statistics
+ *
+ * Timer 2 is otherwise unused: no tone(), and the Servo library takes
+ * timers 5, 1, 3 and 4 on the Mega.  Its OC2B pin is the spark output,
+ * which the tick interrupt drives through OCR2B (see spark.h).
+ */
+
+#ifndef controltick_h
+#define controltick_h
+
+#define	CONTROL_TICK_US	1000	// tick period.  Multiple of 4 up to 1024, of 16 up to 4096.
+
+#define	CT_BINS		8	// lateness histogram: <8 us, then doubling, then >= 512 us
+
+void control_tick_start();
+bool control_tick();
+void control_tick_reset();
+void control_tick_dump();
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * CRC-16/CCITT: polynomial 0x1021, not reflected, start from CRC16_INIT.
+ * Used for telemetry frames and the event log archive.
+ *
+ * On the target this is avr-libc's _crc_xmodem_update, which is the
+ * same polynomial done in a few instructions.  The host tools use the
+ * plain C version.
+ */
+
+#ifndef crc16_h
+#define crc16_h
+
+#include <stdint.h>
+
+#define	CRC16_INIT	0xffff
+
+#ifdef __AVR__
+#include <util/crc16.h>
+
+static inline uint16_t crc16_update(uint16_t crc, uint8_t b)
+{
+	return _crc_xmodem_update(crc, b);
+}
+#else
+static inline uint16_t crc16_update(uint16_t crc, uint8_t b)
+{
+	uint8_t i;
+
+	crc ^= (uint16_t)b << 8;
+	for (i = 0; i < 8; i++)
+		crc = (crc & 0x8000)? (crc << 1) ^ 0x1021: crc << 1;
+	return crc;
+}
+#endif
+
+static inline uint16_t crc16(uint16_t crc, const void *p, unsigned int n)
+{
+	const uint8_t *b = (const uint8_t *)p;
+
+	while (n--)
+		crc = crc16_update(crc, *b++);
+	return crc;
+}
+
+#endif
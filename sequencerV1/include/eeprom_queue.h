@@ -0,0 +1,39 @@
+/*
+ * Background EEPROM writes.
+ *
+ * An EEPROM byte takes about 3.4 ms to erase and write, so committing
+ * a log with EEPROM.put() held up the control loop for seconds.
+ * eeq_write() only queues a job: a range of EEPROM and the bytes to
+ * put there.  The EEPROM ready interrupt then writes one byte each
+ * time the previous one is done, skipping bytes that already hold the
+ * right value.  Jobs are written in the order queued, so a validity
+ * marker queued after its data is only written once the data is.
+ *
+ * A job of more than EEQ_INLINE bytes is written from the caller's
+ * buffer, which must not change until the job is done.  Smaller ones
+ * are copied.  If EEQ_JOBS jobs are already waiting, eeq_write() waits
+ * for the oldest to finish.
+ *
+ * While the queue is busy, the EEPROM must not be read or written any
+ * other way: check eeq_idle(), or call eeq_flush() to wait.
+ *
+ * eeq_run(), called from loop() on every pass, reports on the console
+ * when the queue empties.
+ *
+ * Console command:
+ *	eeq: show EEPROM queue progress
+ */
+
+#ifndef eeprom_queue_h
+#define eeprom_queue_h
+
+#define	EEQ_JOBS	8
+#define	EEQ_INLINE	4
+
+void eeq_write(int addr, const void *src, unsigned int n);
+bool eeq_idle();
+void eeq_flush();
+void eeq_run();
+void eeq_dump();
+
+#endif
@@ -6,22 +6,19 @@
 
 bool eeprom_check_and_init();
 
-#define	MY_EEPROM_MAGIC_NUMBER	11
+#define	MY_EEPROM_MAGIC_NUMBER	12
+#define	EEPROM_MAGIC_V11	11	// before the run archive; its index is cleared
 
 // locations
 #define	EEPROM_MAGIC		0	// 2 bytes
-#define	EEPROM_EVENT_SEQN	2	// 2 bytes
-#define	EEPROM_EVENT_SIZE	4	// 2 bytes
-#define	EEPROM_EVENT_SIZE_2	6	// 2 bytes
+#define	EEPROM_EVENT_SEQN	2	// 2 bytes, newest run in the archive
+// 4-7 unused, were the event log size markers
 
-#define	EEPROM_TRACE_SEQN	8	// 2 bytes
-#define	EEPROM_TRACE_SIZE	10	// 1 byte
-#define	EEPROM_TRACE_SIZE_2	11	// 1 byte
-#define	EEPROM_TRACE_TRIGGER	12	// 2 bytes
-#define	EEPROM_TRACE_INSERT	14	// 2 bytes
-#define	EEPROM_TRACE_PIN	16	// 1 byte
+// 8-16 unused, were the trace header; it is with the trace now
 
-#define	EEPROM_EVENT_LOG	128	// 500 * 4 bytes
+#define	EEPROM_RUN_INDEX	32	// EVENT_RUNS * 4 bytes
 
-#define	EEPROM_DATA_TRACE	2128	// 512 bytes
+#define	EEPROM_EVENT_LOG	128	// event run archive, up to EEPROM_DATA_TRACE (see events.cpp)
+
+#define	EEPROM_DATA_TRACE	3328	// 768 bytes, trace_hdr then the rings (see trace.h)
 
@@ -35,6 +35,9 @@ static const char ss_25[] PROGMEM = "Sequence complete";
 static const char ss_26[] PROGMEM = "Abort on ig pressure < main";
 static const char ss_27[] PROGMEM = "Ig zero recorded";
 static const char ss_28[] PROGMEM = "Main zero recorded";
+static const char ss_29[] PROGMEM = "ms since the button was pressed";
+static const char ss_30[] PROGMEM = "us since the spark started";
+static const char ss_31[] PROGMEM = "us since the spark stopped";
 
 static const char * const event_code_names[] PROGMEM = {
 		ss_00,
@@ -66,4 +69,7 @@ static const char * const event_code_names[] PROGMEM = {
 		ss_26,
 		ss_27,
 		ss_28,
+		ss_29,
+		ss_30,
+		ss_31,
 };
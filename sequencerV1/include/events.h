@@ -1,11 +1,67 @@
 /*
  * During the main sequence we record a bunch of events.
  * After the sequence these are stored in EEPROM for later retrieval.
+ * The last EVENT_RUNS runs are kept, each with its sequence number,
+ * the pressure zeros, the error code it ended on (0 for none) and a CRC.
+ * With an SD card, each run also gets a file there, opened by
+ * event_enable(), and the committed run is written to it in the runbin
+ * frames below before it is closed (see sd_log.h).
  *
- * Here are the known events:
+ * Console commands:
+ *	runs [<n>]: list the runs in EEPROM, or print run n
+ *	runbin [<n> [<baud>]]: send run n (default the newest) as binary
+ *		frames, at <baud> if given, for host/event_decode
+ *
+ * runbin sends the run as it is in EEPROM: a TM_LOG_HDR frame with the
+ * run_hdr, then TM_LOG_DATA frames of up to EVENT_BIN_CHUNK bytes of
+ * packed events, framed like telemetry (see telemetry.h):
+ *	log hdr		u8 TM_LOG_HDR, struct run_hdr, u16 crc
+ *	log data	u8 TM_LOG_DATA, u16 seqn, u16 offset, data, u16 crc
+ * The run_hdr crc covers the whole run.  With a baud rate, the port
+ * switches once the console text before it is out, waits
+ * EVENT_BIN_SETTLE_MS for the PC to follow, and switches back to SQ_BAUD
+ * when the run is sent.  Telemetry is held for all of that (see
+ * telemetry.h).
+ *
+ * Here are the known events.  There is room for 64; the event record
+ * keeps the code in 6 bits.
  */
 
-#define	EVENT_BUFFER_SIZE	250
+#ifndef events_h
+#define events_h
+
+#include <stdint.h>
+
+#define	EVENT_BUFFER_BYTES	1500	// packed, see events.cpp
+#define	EVENT_RUNS		8	// runs kept in EEPROM
+#define	EVENT_NEWEST		0xffff	// for event_select()
+#define	EVENT_BIN_CHUNK		48	// log bytes per TM_LOG_DATA frame
+#define	EVENT_BIN_SETTLE_MS	100	// after a baud change, before sending
+
+/*
+ * Packed event records, see events.cpp
+ */
+#define	EVENT_CODE_MASK		0x3f
+#define	EVENT_PLEN_SHIFT	6
+#define	EVENT_SNAP		3		// in the param bytes field
+#define	EVENT_SNAP_BYTES	7
+#define	EVENT_MAX_BYTES		(1 + 5 + EVENT_SNAP_BYTES)	// a 32 bit time takes 5 bytes
+#define	EVENT_PRESS_MAX		0xfff
+
+/*
+ * A run in the EEPROM archive starts with this, little endian.
+ */
+struct run_hdr {
+	uint16_t seqn;
+	uint16_t len;		// bytes of packed events after the header
+	uint16_t n_events;
+	uint16_t n_dropped;
+	uint16_t zero_ig;
+	uint16_t zero_main;
+	uint8_t abort_code;	// error code, 0 if the run ended normally
+	uint8_t spare;
+	uint16_t crc;		// of the header up to here, then the events
+};
 
 enum event_codes {
 	no_event,	// Nothing to nobody
@@ -37,16 +93,34 @@ enum event_codes {
 	IgLessMain,	// Abort on ig pressure < main
 	IgZero,		// Ig zero recorded
 	MainZero,	// Main zero recorded
+	OpLatency,	// ms from the sample that saw the fire or abort button to acting on it
+	SparkOn,	// us since the first rising edge of a spark run
+	SparkOff,	// us since the last falling edge of a spark run
 };
 
 /*
  * Called to record an event.
- * Pass in the event.  loop_start_t is used for the timestamp
+ * Pass in the event.  loop_start_us is used for the timestamp
+ *
+ * event_snap() records the event with a snapshot of both chamber
+ * pressures and the outputs.  It costs a few more bytes of log, so the
+ * pressure threshold chatter (IgPressOK/NAK, MainPartialOK/NAK) uses
+ * plain events.
  */
 void event_init();
+void event_archive_clear();
 void event_enable();
 void event_disable();
-unsigned int event_commit();
+unsigned int event_commit(unsigned char abort_code);
 void event(enum event_codes, unsigned int p);
+void event_snap(enum event_codes, unsigned int p);
+bool event_select(unsigned int seqn);
+unsigned int event_select_step(int dir);
 bool event_to_serial(int i);
-void event_commit_conditional();
+void event_commit_conditional(unsigned char abort_code);
+void event_list_runs();
+void event_dump(unsigned int seqn);
+void event_dump_bin(unsigned int seqn, unsigned long baud);
+void event_dump_run();
+
+#endif
@@ -19,10 +19,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS / 8,	// debounce
+	0,		// debounce_n
 	0,		// filter_a
 	0,		// use multi_input_ladder #0
+	FILT_MEDIAN3,	// filter	ladder steps, no IIR
+	{0, 0},		// filter_hist
+	8,		// sample_ticks	by hand
+	0,		// sample_wait
+	0,		// capture
     },
     {
 	"ig_pressure",	// name
@@ -33,10 +40,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS,	// debounce
+	0,		// debounce_n
 	0,		// filter_a
 	0,		// use multi_input_ladder #0
+	FILT_OVS(2) | FILT_IIR(2),// filter	12 bits; about as slow as IIR 3 was
+	{0, 0},		// filter_hist
+	1,		// sample_ticks
+	0,		// sample_wait
+	0,		// capture
     },
     {
 	"push_1",	// name
@@ -47,10 +61,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst	unused
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS,	// debounce
+	0,		// debounce_n
 	0,		// filter_a	unused
 	0,		// multi_input_ladder	unused
+	FILT_BYPASS,	// filter	unused
+	{0, 0},		// filter_hist	unused
+	1,		// sample_ticks
+	0,		// sample_wait
+	1,		// capture
     },
     {
 	"push_2",	// name
@@ -61,10 +82,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst	unused
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS,	// debounce
+	0,		// debounce_n
 	0,		// filter_a	unused
 	0,		// multi_input_ladder	unused
+	FILT_BYPASS,	// filter	unused
+	{0, 0},		// filter_hist	unused
+	1,		// sample_ticks	abort button, every tick
+	0,		// sample_wait
+	1,		// capture
     },
     {
 	// True when igniter has been safed.
@@ -76,10 +104,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst	unused
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	2,		// debounce	32 ms; one sample would not debounce
+	0,		// debounce_n
 	0,		// filter_a	unused
 	0,		// multi_input_ladder	unused
+	FILT_BYPASS,	// filter	unused
+	{0, 0},		// filter_hist	unused
+	16,		// sample_ticks	key switch
+	0,		// sample_wait
+	1,		// capture
     },
     {
 	// True when main has been safed.
@@ -91,10 +126,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst	unused
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	2,		// debounce	32 ms; one sample would not debounce
+	0,		// debounce_n
 	0,		// filter_a	unused
 	0,		// multi_input_ladder	unused
+	FILT_BYPASS,	// filter	unused
+	{0, 0},		// filter_hist	unused
+	16,		// sample_ticks	key switch
+	0,		// sample_wait
+	1,		// capture
     },
     {
 	"cmd_1",	// name
@@ -105,10 +147,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst	unused
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS,	// debounce
+	0,		// debounce_n
 	0,		// filter_a	unused
 	0,		// multi_input_ladder	unused
+	FILT_BYPASS,	// filter	unused
+	{0, 0},		// filter_hist	unused
+	1,		// sample_ticks
+	0,		// sample_wait
+	1,		// capture
     },
     {
 	"cmd_2",	// name
@@ -119,10 +168,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst	unused
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS,	// debounce
+	0,		// debounce_n
 	0,		// filter_a	unused
 	0,		// multi_input_ladder	unused
+	FILT_BYPASS,	// filter	unused
+	{0, 0},		// filter_hist	unused
+	1,		// sample_ticks	abort button, every tick
+	0,		// sample_wait
+	1,		// capture
     },
     {
     	"power_sense",	// name
@@ -133,10 +189,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst	unused
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS / 2,	// debounce
+	0,		// debounce_n
 	0,		// filter_a	unused
 	0,		// multi_input_ladder	unused
+	FILT_MEDIAN3 | FILT_IIR(2),// filter	valve switching spikes; IIR 3 when read every tick
+	{0, 0},		// filter_hist
+	2,		// sample_ticks
+	0,		// sample_wait
+	0,		// capture
     },
     {
 	"main_press",	// name
@@ -147,10 +210,17 @@ struct input inputs[n_inputs] = {
 	0,		// analog_hyst
 	0,		// prev_val
 	0,		// current_val
-	no_edge,	// edge
-	0,		// last_change_t
+	0,		// edges
+	{0, 0, 0, 0},	// edge_q
+	DEBOUNCE_MS,	// debounce
+	0,		// debounce_n
 	0,		// filter_a
 	0,		// use multi_input_ladder #0
+	FILT_OVS(2) | FILT_IIR(2),// filter	12 bits; about as slow as IIR 3 was
+	{0, 0},		// filter_hist
+	1,		// sample_ticks
+	0,		// sample_wait
+	0,		// capture
     },
 };
 
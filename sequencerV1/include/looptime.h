@@ -0,0 +1,65 @@
+/*
+ * Loop timing instrumentation.
+ *
+ * loop() brackets each of its phases with calls here.  Only passes
+ * that run a control step (see controltick.h) are counted.  For every
+ * state we keep the min, max and mean time of each phase and of the
+ * whole loop, plus a log2 histogram of whole loop time.  Each phase
+ * also has a log2 histogram over all states.  Times are in micros(),
+ * so they have 4 us resolution.
+ *
+ * Statistics are kept for the first LT_N_STATES-1 states seen since
+ * the last reset; any further states share the last slot.  Reset just
+ * before the run you care about.
+ *
+ * Console:
+ * 	looptime		print the statistics, a line at a time
+ * 	looptime reset		clear the statistics
+ *
+ * Costs about 1050 bytes of RAM and 12 calls to micros() per loop.
+ * Check the stack headroom with the ram command (see ram.h) after
+ * growing it.  Drop the define below to get the RAM back.
+ */
+
+#ifndef looptime_h
+#define looptime_h
+
+#define	LOOPTIME	1
+
+enum lt_phase {
+	lt_serial,	// handle_serial
+	lt_cmd,		// handle_cmd
+	lt_inputs,	// read_inputs
+	lt_joystick,	// joystick_edge_trigger
+	lt_check,	// check_state
+	lt_outputs,	// update_outputs
+	lt_tft,		// tft_queue_run
+	lt_eeq,		// eeq_run
+	lt_sd,		// sdl_run
+	lt_dump,	// looptime_to_serial, event_dump_run, trace_run
+	lt_n_phases
+};
+
+#ifdef LOOPTIME
+
+#define	LT_N_STATES	8	// last slot is shared by all later states
+#define	LT_BINS		10	// <16 us, then doubling, then >= 4096 us
+
+void looptime_reset();
+void looptime_start();
+void looptime_phase(enum lt_phase p);
+void looptime_end();
+void looptime_dump();
+void looptime_to_serial();
+
+#else
+
+static inline void looptime_reset() {}
+static inline void looptime_start() {}
+static inline void looptime_phase(enum lt_phase p) {}
+static inline void looptime_end() {}
+static inline void looptime_dump() {}
+static inline void looptime_to_serial() {}
+
+#endif
+#endif
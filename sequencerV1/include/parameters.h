@@ -3,8 +3,11 @@
  *  Until then, they are compiled in
  */
 
-typedef int int16_t;
+#ifdef __AVR__
+typedef int int16_t;	// same as avr-libc; other targets get it from stdint.h
+#endif
 static const unsigned long spark_period = 25;	// milliseconds.  40 Hz
+static const unsigned long spark_high = 12;	// milliseconds of each period, see spark.h
 
 /*
  * Servo settings, in degrees.
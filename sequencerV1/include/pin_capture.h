@@ -0,0 +1,38 @@
+/*
+ * Interrupt side capture of digital inputs.
+ *
+ * read_inputs() looks at a pin once per control step, so it sees the
+ * level then and nothing of what happened in between.  A captured pin
+ * is watched from an interrupt: each change of its raw level is
+ * counted and timed with micros(), and read_input() takes the count,
+ * the level and the time of the latest change once per sample.  Any
+ * change since the last sample restarts the input's debounce, even
+ * when the pin is back where it was, so a bounce or a glitch between
+ * two samples is never taken for a steady level, and the edge gets the
+ * time the pin changed instead of the time of the sample.  Captured
+ * inputs keep the same debounce as the others (DEBOUNCE_MS in
+ * state_machine.h); a shorter one would want measured bounce times.
+ *
+ * On the Mega 2560 only PORTB (53-50, 10-13), PJ0-1 (15, 14), PE0 (0)
+ * and PORTK (A8-A15) have pin change interrupts.  A captured pin on one
+ * of those uses it.  The buttons, command inputs and safe switches are
+ * on PORTA (22-29), which has none, so those are scanned from the ADC
+ * conversion interrupt instead (see adc_sampler.h), every ADC_CONV_US:
+ * a change is timed to within 104 us rather than the 1 ms of the
+ * control tick, and a pulse shorter than that can be missed.
+ *
+ * On the host, a captured pin is looked at whenever the scenario sets
+ * it, as a pin change interrupt would.
+ */
+
+#ifndef pin_capture_h
+#define pin_capture_h
+
+#define	CAPTURE_MAX	6	// captured pins
+
+bool pin_capture_add(unsigned char pin);
+void pin_capture_start();
+bool pin_capture_read(unsigned char pin, unsigned char *level, unsigned long *t_us);
+void pin_capture_scan();
+
+#endif
@@ -12,7 +12,9 @@ extern unsigned char main_valid;
 #define	PC_SCALE	16
 
 // If the ig pressure is valid, then this is true if ig pressure is less than parameter in gauge PSI.
-// p is the raw sensor reading, x is the comparison in psi
+// p is the sensor's filter_a, x is the comparison in psi.  The pressures are oversampled to
+// 12 real bits (FILT_OVS(2) in io.h), so a count here is a quarter of an ADC count, and
+// filter_a trails the chamber by adc_delay_us() (about 4 ms) plus the IIR (4 ticks).
 #define	IG_PRESSURE_LESS_THAN(p, x)	((p) < zero_ig || (((p) - zero_ig) * PC_SCALE < (x) * P_SLOPE_IG))
 #define	MAIN_PRESSURE_LESS_THAN(p, x)	((p) < zero_main || (((p) - zero_main) * PC_SCALE < (x) * P_SLOPE_MAIN))
 #define	IG_PRESSURE_VALID(p)		(ig_valid && (p) >= min_pressure && (p) <= max_pressure)
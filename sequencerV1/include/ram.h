@@ -0,0 +1,26 @@
+/*
+ * RAM use on the Mega.
+ *
+ * The Mega has 8 KB of RAM for .data, .bss, the heap and the stack.
+ * The rings and logs (event_buffer, the trace, loop timing, the
+ * serial, TFT and SD buffers) are all static, so most of it is known
+ * at link time: avr-size gives .data + .bss, as does the ram command.
+ *
+ * What the stack actually needs is measured: ram_paint(), first thing
+ * in setup(), fills the free RAM between the heap and the stack with
+ * RAM_PAINT, and ram_dump() finds the lowest byte that has since been
+ * overwritten.  Run the sequence and the menus before looking.
+ *
+ * Console:
+ * 	ram		show static, heap and stack use, and stack headroom
+ */
+
+#ifndef ram_h
+#define ram_h
+
+#define	RAM_PAINT	0xa5
+
+void ram_paint();
+void ram_dump();
+
+#endif
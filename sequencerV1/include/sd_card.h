@@ -0,0 +1,56 @@
+/*
+ * Raw SD card blocks.
+ *
+ * The TFT shield has a microSD slot on the same SPI bus as the display,
+ * selected by SD_CS.  The shield is wired to the Mega by jumpers, not
+ * plugged in, so its card select goes to a pin of ours next to the
+ * display's (TFT_CS 53, TFT_DC 49 in sequencerV1.ino), not the shield's
+ * pin 4, which is the igniter N2O valve here.  validate_io() checks it
+ * is not one of the inputs or outputs.
+ *
+ * This is the card as a row of SD_BLOCK byte blocks, numbered from 0.
+ * sd_log.h keeps run files in them.
+ *
+ * sd_init(), from setup(), finds and starts the card; it waits, so it
+ * is only for setup().  sd_read() waits for the data, and is also only
+ * for setup().
+ *
+ * sd_write() starts writing one block and sends the first SD_PIECE
+ * bytes of it.  Each sd_busy() call sends the next piece, about 100 us,
+ * so a block, about 1 ms in all, goes out over a number of passes
+ * through loop() and no pass waits for it.  Once it is all out the card
+ * programs it, which can take from a millisecond to a few hundred, and
+ * sd_busy() says whether that is done, without waiting.  Call nothing
+ * else until it is, then sd_write_refused() says whether the card
+ * turned the block down.  src is read as it goes, so leave it alone
+ * until sd_busy() is false.  A write sends n bytes and then zeros to
+ * fill the block, so the caller needs no SD_BLOCK byte buffer.
+ *
+ * Sharing the bus with the display: the card and the display are only
+ * used from loop(), never from interrupts.  While a block is being
+ * sent, sd_sending(), the card keeps SD_CS low and has the bus, and
+ * tft_queue_run() leaves the display alone.  Otherwise each call here
+ * saves the SPI settings the display left, sets the card's, and puts
+ * the display's back before returning, with SD_CS high and one more
+ * clock so the card lets go of MISO.  The display library never sees
+ * the card.
+ *
+ * On the host the card is a file, see host.h.
+ */
+
+#ifndef sd_card_h
+#define sd_card_h
+
+#define	SD_BLOCK	512
+#define	SD_CS		48	// card select, jumpered from the 1.8" TFT shield
+#define	SD_PIECE	64	// bytes of a block sent per sd_busy()
+
+bool sd_init();
+unsigned long sd_blocks();	// 0 if there is no card
+bool sd_write(unsigned long lba, const void *src, unsigned int n);
+bool sd_busy();
+bool sd_sending();
+bool sd_write_refused();
+bool sd_read(unsigned long lba, void *dst, unsigned int n);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Run files on the SD card.
+ *
+ * The EEPROM holds EVENT_RUNS event logs and one trace.  The card holds
+ * as many runs as fit, with the telemetry of the whole run alongside.
+ * It is used raw, without a filesystem: a FAT library wants a 512 byte
+ * buffer and more RAM than is left.
+ *
+ * Block 0 of the card (see sd_card.h) is the sdl_super.  From block 1
+ * on, each block is an sdl_blk header and len bytes of one file, then
+ * zeros.  Only SDL_DATA bytes of each 512 are used, so the block being
+ * filled takes that much RAM instead of a whole block; the card has
+ * room to spare.  A file is a run of blocks with its number, one after
+ * the other.  When the last block of the card is used the next one is
+ * block 1 again, over the oldest file.
+ *
+ * A file holds frames as sent on the serial port (see telemetry.h),
+ * and no frame is split between blocks, so host/sd_cat can copy a file
+ * out of a card image for host/telem_decode or host/event_decode.
+ *
+ * sdl_write() copies bytes into the block being filled and never
+ * waits.  When they do not fit, the block is closed and they go to a
+ * spill area of SDL_SPILL bytes, to start the next block; when that is
+ * full too, the write is refused and counted.  Writers that can wait,
+ * like the copies of the event log and the trace, check sdl_room()
+ * first, so the count is of what was lost.  sdl_frame() frames a body
+ * and writes it.  sdl_run(), called from loop() on every pass,
+ * starts sending a closed block once the card has finished the
+ * previous one, and the block goes out a piece per pass (see
+ * sd_card.h).  Nothing is added to it until it is on the card.
+ *
+ * The super block is rewritten when a file is opened and when it is
+ * closed.  If the Mega resets with a file open, sdl_init() finds the
+ * end of it by reading its block headers, and closes it.
+ *
+ * The main sequence opens a file when it starts recording events.
+ * While it is open, telemetry (when on) writes its frames there too,
+ * and a trace written to EEPROM is also written there as TM_TRACE
+ * frames.  The committed event log is written as for runbin, and
+ * closes the file.
+ *
+ * Console commands:
+ *	sd: show the card and the open file
+ *	sd open: start a new file, closing any open one
+ *	sd close: close the open file
+ */
+
+#ifndef sd_log_h
+#define sd_log_h
+
+#include <stdint.h>
+#include "sd_card.h"
+#include "telemetry.h"
+
+#define	SDL_DATA	252		// file bytes per block
+#define	SDL_SPILL	TM_WIRE_MAX	// one frame
+#define	SDL_MAGIC	0x314c5153UL	// "SQL1"
+#define	SDL_TIMEOUT_MS	500		// card busy longer than this is dead
+
+/*
+ * Block 0, little endian.
+ */
+struct sdl_super {
+	uint32_t magic;
+	uint16_t file;		// newest file, 0 for none
+	uint8_t open;		// it was not closed
+	uint8_t wrapped;	// blocks have been reused
+	uint32_t first;		// its first block
+	uint32_t next;		// next block to write
+	uint16_t crc;		// of the super block up to here
+};
+
+/*
+ * Start of each data block.
+ */
+struct sdl_blk {
+	uint16_t file;
+	uint16_t len;		// file bytes after the header, up to SDL_DATA
+};
+
+void sdl_init();
+void sdl_open();
+void sdl_close();
+unsigned int sdl_file();
+unsigned int sdl_room();
+bool sdl_write(const void *src, unsigned char n);
+bool sdl_frame(unsigned char *body, unsigned char len);
+void sdl_run();
+void sdl_cmd(const char *arg);
+
+#endif
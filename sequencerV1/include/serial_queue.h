@@ -0,0 +1,76 @@
+/*
+ * Queued serial output.
+ *
+ * At 9600 baud a character takes about 1 ms to send and the hardware
+ * transmit buffer holds 63 of them, so a long print stalls loop() until
+ * all but the last 63 characters are out.  Console output goes through
+ * the SerialQueue objects below instead.  They put characters in a RAM
+ * ring, and serial_queue_run(), called from loop() between control
+ * ticks, moves them to Serial as fast as the hardware buffer takes them,
+ * for at most SQ_SLICE_US per call.
+ *
+ * There are three objects, one per priority, writing into the same ring
+ * in the order they are called:
+ *	console_urgent	aborts and other things that must not be lost
+ *	console		console commands, state transitions
+ *	console_bulk	dumps of the event log, trace and loop times, help
+ * The lower the priority, the more of the ring is kept free for the
+ * others.  availableForWrite() tells how much a priority may still use;
+ * dumps check it before each line so they never fill the ring.
+ *
+ * Normally a write to a full ring sends the oldest characters to make
+ * room, which waits on the serial port as a plain Serial.print() does.
+ * serial_queue_hold() stops that until serial_queue_release(): a write
+ * that does not fit is dropped, with the rest of its line, and counted.
+ * The main sequence holds the queue from ignition to the end of the burn.
+ *
+ * The port runs at SQ_BAUD.  serial_queue_baud() changes it; to not cut
+ * a character short, call it only once serial_queue_idle() says all
+ * queued output is out.
+ *
+ * Console command:
+ *	txq [reset]: show or clear queue use and drop counts
+ */
+
+#ifndef serial_queue_h
+#define serial_queue_h
+
+#include <Arduino.h>
+
+#define	SQ_SIZE		256	// ring bytes.  Indexes are unsigned char.
+#define	SQ_SLICE_US	200	// most time to spend sending per pass
+#define	SQ_LINE		64	// room to ask for before a line of a dump
+#define	SQ_BAUD		9600
+
+enum sq_prio {
+	sq_bulk,
+	sq_normal,
+	sq_urgent,
+	sq_n_prios
+};
+
+class SerialQueue : public Print {
+public:
+	SerialQueue(sq_prio p) : prio(p) {}
+	size_t write(uint8_t c);
+	using Print::write;
+	int availableForWrite();
+
+private:
+	unsigned char prio;
+};
+
+extern SerialQueue console;
+extern SerialQueue console_bulk;
+extern SerialQueue console_urgent;
+
+void serial_queue_run();
+void serial_queue_flush();
+bool serial_queue_idle();
+void serial_queue_baud(unsigned long baud);
+void serial_queue_hold();
+void serial_queue_release();
+void serial_queue_reset();
+void serial_queue_dump();
+
+#endif
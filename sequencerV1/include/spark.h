@@ -0,0 +1,62 @@
+/*
+ * Spark generator.
+ *
+ * The spark box fires on each rising edge of o_spark.  The waveform
+ * used to be made by the control step, which set o_spark on or off from
+ * loop_start_t every pass: its edges moved with the step's lateness,
+ * and a step that stalled (a TFT fill) stopped the spark with it.
+ *
+ * Now the control tick interrupt makes it (see controltick.h).  o_spark
+ * is on pin 9, which is OC2B, timer 2's second compare output, and
+ * timer 2 is the control tick.  Each tick the interrupt works out the
+ * level for the tick that has just begun and sets the compare output
+ * to set or clear the pin when the count reaches OCR2B, SPARK_EDGE_US
+ * into the tick.  So every edge is made by the timer, on a tick
+ * boundary plus SPARK_EDGE_US, whatever the interrupt latency and
+ * whatever loop() is doing.  The period and high time are whole ticks.
+ *
+ * States ask for the spark by calling spark_run() on each control step
+ * they want it, as they always have.  spark_step(), after check_state(),
+ * starts the generator on the first such step and stops it on the first
+ * step without one, so a state that is left, or a branch that no longer
+ * calls it, stops the spark.  The interrupt also stops it by itself
+ * when no spark_step() has asked for a whole period, so a stalled or
+ * dead loop does not spark on, and myPanic() calls spark_stop() first
+ * thing.  A run starts with a whole high time and stops low, cutting
+ * the last one short if need be; the spark fires on the rising edge.
+ * The generator then gives the pin back to update_outputs(), and
+ * o_spark's own state (off, or the spark test's one-shot) applies
+ * again.  While it runs o_spark->cur_state is not looked at.
+ *
+ * The interrupt times the first rising edge and the last falling edge
+ * of each run.  spark_step() logs them, once they have happened, as
+ * SparkOn and SparkOff events (see events.h) with the microseconds from
+ * the edge to the event's own time.  IgSpark and IgSparkOff are when
+ * the sequence asked.
+ *
+ * On the host there is no compare output.  The pin is written from the
+ * polled tick, at the tick rather than SPARK_EDGE_US into it.
+ *
+ * Console:
+ * 	spark			show the settings and the last run
+ * 	spark <period> [<high>]	set the period and high time, in ms.
+ * 				The high time defaults to half the period.
+ */
+
+#ifndef spark_h
+#define spark_h
+
+#include "controltick.h"
+
+#define	SPARK_PIN	9			// OC2B
+#define	SPARK_EDGE_US	(CONTROL_TICK_US / 2)	// edges are this far into their tick
+#define	SPARK_MS_MAX	250			// longest period
+
+void spark_run();
+void spark_step();
+void spark_stop();
+void spark_tick(unsigned long tick_us);
+bool spark_running();
+void spark_cmd(const char *period, const char *on);
+
+#endif
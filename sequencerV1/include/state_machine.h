@@ -32,10 +32,13 @@
  * block and degrade latency.)
  *
  * LCD output is buffered and interleaved into state machine operation to preserve latency.
+ * (TFT drawing is queued and sent in slices between control ticks; see tft_queue.h.)
  *
- * Typical loop time with small console IO is < 1 ms with low-complexity states and no LCD
- * updates. LCD updates happen one character per loop, and character write time is about 24
- * ms, so loop times are 24-25 ms during LCD updates.
+ * The control step runs once per 1 ms tick (see controltick.h) and takes well under that
+ * with small console IO.  LCD drawing no longer adds to it: the queue sends at most
+ * TFTQ_SLICE_US of drawing per pass between ticks, and cuts a screen erase into pieces, so
+ * an LCD update delays the next step by at most about half a millisecond.  The looptime
+ * console command reports measured per-state, per-phase loop times (see looptime.h).
  *
  */
 
@@ -97,8 +100,101 @@ enum output_state {
 	servo_controlled,
 };
 
-#define ANALOG_FILTER_TIME 8
-#define ANALOG_FILTER_SCALE 4
+/*
+ * Analog input filters.
+ *
+ * Each analog input has a filter byte saying what read_input() does
+ * with its samples, in this order:
+ *	FILT_MEDIAN3	take the median of this sample and the two before,
+ *			so a one sample spike never gets through
+ *	FILT_IIR(k)	first order low pass, filter_a += (x - filter_a) / 2^k,
+ *			with a shift.  Time constant about 2^k control ticks,
+ *			k from 1 to FILT_IIR_MAX.
+ * FILT_BYPASS, neither, leaves filter_a the latest sample, for checks
+ * that want the raw value.  filter_a is ANALOG_FILTER_SCALE times the
+ * ADC counts, so the IIR keeps two more bits than the ADC gives; the
+ * analog_th and multi_input ladder checks use it divided back down.
+ * A multi_input should not have an IIR, or it passes through the
+ * ladder steps in between on its way to a new one.
+ *
+ * FILT_OVS(b) has the ADC sampler oversample the input by b bits, up
+ * to ANALOG_FILTER_SHIFT (see adc_sampler.h), so those bits of
+ * filter_a are real rather than just kept by the IIR.  Set at startup
+ * only.  Oversampled samples change once per window, so do not give
+ * them FILT_MEDIAN3, which would hold each one a window longer.
+ */
+#define ANALOG_FILTER_SHIFT 2
+#define ANALOG_FILTER_SCALE (1 << ANALOG_FILTER_SHIFT)
+
+#define FILT_BYPASS	0x00
+#define FILT_IIR(k)	(k)
+#define FILT_IIR_MASK	0x0f
+#define FILT_IIR_MAX	4	// settles within 2^(k-1) of the input: 2 ADC counts at 4
+#define FILT_MEDIAN3	0x10
+#define FILT_OVS(b)	((b) << 5)
+#define FILT_OVS_BITS(f)	(((f) >> 5) & 3)
+
+/*
+ * Input sample scheduling.
+ *
+ * read_inputs() reads each input every sample_ticks control steps, so
+ * inputs that change slowly, or only by hand, do not cost every tick.
+ * sample_wait counts down the steps to the next read; setup_inputs()
+ * staggers the slow inputs so they do not all come due on the same
+ * tick.  Debounce counts samples, so a slow input's debounce is that
+ * many samples of sample_ticks each; keep sample_ticks small enough
+ * that a press is seen on several samples.  The analog filters run
+ * once per sample too, so an IIR's time constant is 2^k samples, not
+ * ticks.  Inputs that check_ functions react to at once (the pressures,
+ * the abort buttons) stay at 1.
+ */
+#define SAMPLE_TICKS_MAX 16
+
+/*
+ * Debounce.
+ *
+ * A new value of an input becomes current_val, with an edge, once it
+ * has been read debounce times in a row after the sample that first
+ * saw it.  debounce_n counts them, and starts over whenever the value
+ * read changes, so a bounce restarts the wait, as the time since the
+ * last change did before.  A counter rather than an up/down
+ * integrator, because a multi_input has more than two values.
+ * Everything is in samples of the control tick: no millis(), and one
+ * byte per input where the time of the last change took four.
+ * DEBOUNCE_MS is the usual wait; an input's debounce is that divided
+ * by its sample_ticks.
+ */
+#define DEBOUNCE_MS 25
+
+/*
+ * Input edges.
+ *
+ * Each debounced change of an input is an edge.  edges counts them,
+ * mod 256, and edge_q keeps the latest EDGE_Q - 1, at edge_q[n %
+ * EDGE_Q] for edge n: the low 15 bits of loop_start_t at the sample
+ * that first saw the new value, before debounce, with EDGE_RISING set
+ * if the new value is non-zero.  The slot after the newest holds the
+ * time of a change still being debounced.
+ *
+ * Edges are not cleared by whoever reads them.  Each reader keeps its
+ * own cursor, an unsigned char per input it watches, and:
+ *	edge_skip()	moves the cursor past every edge so far, say on
+ *			entering a state, so an old press does not count
+ *	edge_next()	returns the next edge after the cursor, and its
+ *			time, or no_edge
+ *	edge_rose()	reads all the edges after the cursor, true if one
+ *			of them was rising, with the time of the first that was
+ *	edge_last()	the time of the newest edge, for a reader that
+ *			goes by current_val but wants to know since when
+ * So a press and release between two reads is still a press, and two
+ * readers do not take edges from each other.  A cursor more than
+ * EDGE_Q - 1 edges behind skips to the oldest kept; edge_overruns
+ * counts the edges skipped.  edge_age() is the ms from an edge's time
+ * to loop_start_t, for the latency events.
+ */
+#define EDGE_Q		4
+#define EDGE_RISING	0x8000
+#define EDGE_T_MASK	0x7fff
 
 struct input {
   const char* const name;			// max 11 characters
@@ -109,12 +205,36 @@ struct input {
   int analog_hyst;
   unsigned char prev_val;
   unsigned char current_val;	// this is the digital value of the input pin, debounced, etc.
-  enum input_edge edge;		// signal rising, falling or none.
-  unsigned long last_change_t;
+  unsigned char edges;		// debounced changes so far, mod 256
+  unsigned int edge_q[EDGE_Q];	// their times, see above
+  unsigned char debounce;	// samples a new value must hold for, at least 1
+  unsigned char debounce_n;	// samples it has held so far
   unsigned int filter_a;	// this is the analog value of the input pin, filtered, if analog_th >= 0.
   unsigned char multi_input_ladder; // which multi_input_ladder should we use?
+  unsigned char filter;		// FILT_ bits, for analog inputs
+  unsigned int filter_hist[2];	// the last two samples, for FILT_MEDIAN3
+  unsigned char sample_ticks;	// read every this many control steps, 1 to SAMPLE_TICKS_MAX
+  unsigned char sample_wait;	// steps to the next read
+  unsigned char capture;	// 1 to watch the pin from an interrupt (pin_capture.h), digital only
 };
 
+/*
+ * Output writes.
+ *
+ * output_setup() looks up each output's PORTx register and bit once,
+ * and update_output() writes the register directly, and only when the
+ * level it wants differs from level, the last one it wrote.  digitalWrite()
+ * looked the pin up in the core's tables on every call, for every output
+ * every tick.  Anything that writes an output pin itself (sendtodaq,
+ * setup()) should call output_forget() after, so the next
+ * update_output() writes the pin again.  In case something does not,
+ * update_outputs() also forgets one output each step, in turn, so every
+ * pin is rewritten at least every n_outputs steps (10 ms); the old
+ * digitalWrite() rewrote it every step.  The outputs table in io.h does
+ * not set these fields.
+ */
+#define OUT_LEVEL_NONE 0xff
+
 struct output {
   const char * const name;
   unsigned char pin;
@@ -126,6 +246,9 @@ struct output {
   	unsigned long pulse_t;	// used for blinking/pulsed outputs
 	unsigned long servo_pos;// in degrees
   } p;
+  unsigned char level;		// last written, OUT_LEVEL_NONE if not known
+  unsigned char mask;		// the pin's bit in its PORTx
+  volatile uint8_t *port;	// its PORTx, from output_setup()
 };
 
 struct state {
@@ -150,11 +273,25 @@ const struct state* check_startup();
 extern const struct state startup;
 extern const struct state * current_state;
 
-extern const unsigned long debounce_t;
 extern const boolean verbose;
 extern unsigned long state_enter_t;
+extern unsigned long state_enter_us;
 extern unsigned long state_end_t;
 extern unsigned long loop_start_t;
+extern unsigned long loop_start_us;
+
+/*
+ * Wrap-safe time comparison, for millis() or micros() based times.
+ * True once time now has reached time t.  Good for t up to half the
+ * wrap period (35 minutes for micros()) either side of now.
+ * Elapsed time is just now - then, in unsigned long.
+ */
+#define	TIME_REACHED(now, t)	((long)((now) - (t)) >= 0)
+
+/*
+ * Parameters are in ms; state and sequence timers run off loop_start_us.
+ */
+#define	US(ms)	((unsigned long)(ms) * 1000UL)
 
 void input_setup(struct input* in);
 void output_setup(struct output* out);
@@ -163,10 +300,22 @@ void setup_inputs();
 void setup_outputs();
 void read_input(struct input* in);
 void read_inputs();
+void filter_cmd(struct input *in, const char *what, const char *spec);
+void sample_cmd(struct input *in, const char *spec);
+void edge_skip(const struct input *in, unsigned char *cur);
+enum input_edge edge_next(const struct input *in, unsigned char *cur, unsigned int *t);
+bool edge_rose(const struct input *in, unsigned char *cur, unsigned int *t);
+unsigned int edge_last(const struct input *in);
+unsigned int edge_age(unsigned int t);
+extern unsigned int edge_overruns;
 void update_outputs();
+void output_forget(struct output* out);
+void outputs_cmd(const char *what);
+unsigned int output_bitmap();
 void check_state();
 void handle_serial();
 void handle_cmd();
+void help_run();
 int find_str(const char* s, const char** a, const int n);
 boolean validate_io();
 
@@ -0,0 +1,71 @@
+/*
+ * Binary telemetry.
+ *
+ * While on, every telem_period ms the control step sends a sample
+ * frame on the serial port with the filtered pressures, the outputs and
+ * the current state.  host/telem_decode turns the stream into CSV.
+ *
+ * Frames go through console_bulk (see serial_queue.h).  A sample that
+ * does not fit in the queue is skipped, never waited for, so telemetry
+ * costs the control step a few tens of microseconds at most.  At
+ * 9600 baud a sample frame takes about 20 ms to send; TELEM_MIN_MS
+ * keeps the rate within the line with room for console text.
+ *
+ * Frame on the wire: 0x00, COBS encoded body, 0x00.  The body, little
+ * endian, ends in a CRC-16/CCITT (poly 0x1021, init 0xffff) of the
+ * bytes before it:
+ *	sample	u8 TM_SAMPLE, u8 seq, u32 loop_start_us, u8 state id,
+ *		u16 output bitmap, u16 ig_pressure, u16 main_press,
+ *		u16 power_sense, u16 crc
+ *	state	u8 TM_STATE, u8 seq, u8 state id, name, u16 crc
+ * seq counts samples, sent or skipped, so a gap means lost samples.
+ * Bit i of the output bitmap is outputs[i] on (on, single_on or
+ * pulse_on).  Pressures are filter_a, ANALOG_FILTER_SCALE x ADC counts.
+ * State ids are handed out as states are first seen; a state frame
+ * names the id, and is sent whenever the state changes.
+ *
+ * telemetry_hold() stops state and sample frames going to the serial
+ * port until telemetry_release().  Samples meanwhile count as skipped,
+ * and the SD file still gets them.  runbin holds telemetry while it
+ * changes the baud rate, which has to wait for an empty queue.
+ *
+ * telemetry_frame() sends any frame this way; the runbin command (see
+ * events.h) uses it for the TM_LOG_ frames.  Bodies are at most
+ * TM_BODY_MAX bytes with the CRC.  telemetry_encode() only frames the
+ * body, into at most TM_WIRE_MAX bytes.
+ *
+ * While a run file is open on the SD card (see sd_log.h), state and
+ * sample frames are also written there, whether or not they fit in the
+ * serial queue.  A trace is written there as
+ *	trace	u8 TM_TRACE, u16 trace seqn, u16 offset, data, u16 crc
+ * where the data is the trace_hdr and the rings as in EEPROM (see
+ * trace.h), in pieces at increasing offsets.
+ *
+ * Console command:
+ *	telem [off | <ms>]: show telemetry status, stop it, or send a
+ *		sample every <ms>
+ */
+
+#ifndef telemetry_h
+#define telemetry_h
+
+#define	TELEM_MIN_MS	25	// 20 byte sample frames at 9600 baud: 80% of the line
+#define	TM_BODY_MAX	64
+#define	TM_WIRE_MAX	(TM_BODY_MAX + TM_BODY_MAX / 254 + 3)
+
+enum tm_frame {
+	TM_SAMPLE = 1,
+	TM_STATE,
+	TM_LOG_HDR,
+	TM_LOG_DATA,
+	TM_TRACE,
+};
+
+void telemetry_step();
+void telemetry_cmd(const char *arg);
+void telemetry_hold();
+void telemetry_release();
+bool telemetry_frame(unsigned char *body, unsigned char len);
+unsigned char telemetry_encode(unsigned char *body, unsigned char len, unsigned char *wire);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Deferred TFT drawing.
+ *
+ * Everything that draws on the display goes through the TftQueue object
+ * named tft, which has the parts of the Adafruit_GFX interface that
+ * the states use.  Calls only queue a command.  tft_queue_run(), called
+ * from loop() between control ticks, sends queued commands to the
+ * display for at most TFTQ_SLICE_US per call.  Fills are cut into
+ * pieces of TFTQ_FILL_PX pixels so a screen erase (about 100 ms) is
+ * spread over a couple of hundred passes instead of stalling one.
+ * A character is drawn in one piece.
+ *
+ * tft.pause() stops sending until tft.resume().  The main sequence
+ * pauses the display from ignition to the end of the burn.
+ *
+ * The queue is TFTQ_SIZE bytes.  Characters take one byte, other
+ * commands up to 11.  fillScreen() throws away whatever is still queued,
+ * since it would be painted over, so a new screen starts with an empty
+ * queue.  If the queue fills anyway, paused or not, new commands are
+ * dropped and the display is wrong until the next fillScreen().
+ * Nothing waits for the display.
+ *
+ * The display hardware itself is tft_hw; only setup() and this module
+ * should touch it.
+ */
+
+#ifndef tft_queue_h
+#define tft_queue_h
+
+#include <Adafruit_GFX.h>    // Core graphics library
+#include <Adafruit_ST7735.h> // Hardware-specific library
+
+#define	TFTQ_SIZE	256	// queue bytes.  Indexes are unsigned char.
+#define	TFTQ_SLICE_US	500	// most time to spend drawing per pass
+#define	TFTQ_FILL_PX	64	// pixels per fill piece, about 300 us
+
+class TftQueue : public Print {
+public:
+	void fillScreen(uint16_t color);
+	void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+	void setCursor(int16_t x, int16_t y);
+	void setTextColor(uint16_t c) { setTextColor(c, c); }	// same as GFX: c == bg is transparent
+	void setTextColor(uint16_t c, uint16_t bg);
+	void setTextSize(uint8_t s);
+	void setTextWrap(bool w);
+	size_t write(uint8_t c);
+	using Print::write;
+
+	void pause();
+	void resume();
+	bool idle();
+};
+
+extern Adafruit_ST7735 tft_hw;
+extern TftQueue tft;
+
+void tft_queue_run();
+
+#endif
@@ -1,28 +1,88 @@
 /*
- * Define what pin we are tracing.  If nothing, then not tracing.
+ * Trace recorder.
+ *
+ * Always on.  Every trace period control ticks, trace_step() records
+ * filter_a of ig_pressure, main_press and power_sense into a RAM ring
+ * of TRACE_SAMPLES samples.  A trigger, error_state() or an event with
+ * the trace event code, lets post more samples in and then freezes the
+ * ring, so it holds TRACE_SAMPLES - post samples up to the trigger and
+ * post after it.  Only the first trigger counts until the ring is
+ * running again.
+ *
+ * Alongside, an envelope covers a longer time: every control tick
+ * goes into a bucket of env ticks, and each bucket keeps the min, mean
+ * and max of each channel, so slow drift and one tick spikes both show.
+ * TRACE_ENV_BUCKETS of them are kept, in a ring that freezes with the
+ * sample ring.  The bucket open at the freeze is closed early.
+ *
+ * trace_run(), called from loop() on every pass, writes a frozen trace
+ * to EEPROM_DATA_TRACE once the EEPROM queue is idle and, if a run file
+ * is open on the SD card, to it as TM_TRACE frames (see telemetry.h).
+ * It restarts the ring when both are written.
+ *
+ * Values are 12 bits, two to three bytes: the first in byte 0 and the
+ * low 4 bits of byte 1, the second in the high 4 bits of byte 1 and
+ * byte 2.  Value k of the ring is channel k % TRACE_CHANNELS of sample
+ * k / TRACE_CHANNELS.  The ring takes TRACE_BYTES of RAM.  The
+ * envelope ring is packed the same way, min, mean and max of each
+ * channel per bucket, in TRACE_ENV_BYTES.
+ *
+ * In EEPROM a trace_hdr is followed by the sample ring and then the
+ * envelope ring, as they were in RAM.  The header's CRC covers all
+ * three; the header is written last.
+ *
+ * Console commands:
+ *	trace: show the recorder settings and state
+ *	trace period <ticks>: sample every <ticks> control ticks, 1-255
+ *	trace post <n>: samples to keep after the trigger
+ *	trace event <code>: also trigger on event <code>, 0 for none
+ *	trace env <ticks>: control ticks per envelope bucket
+ *	tracedump: print the trace in EEPROM, samples then envelope
  */
 
-/*
- * For now, do not define trace.  It costs us too much local memory, and things break.
- */
-//#define TRACE 1
-#ifdef TRACE
+#ifndef trace_h
+#define trace_h
 
-/*
- * Some interesting pins:
- * 	A1 = main pressure
- * 	A2 = ig pressure
- * 	A5 = power supply
- */
-#define	TRACE_PIN	A5
+#include <stdint.h>
+
+#define	TRACE_CHANNELS	3
+#define	TRACE_SAMPLES	64
+#define	TRACE_BYTES	(TRACE_SAMPLES * TRACE_CHANNELS * 3 / 2)
+#define	TRACE_ENV_BUCKETS	24
+#define	TRACE_ENV_BYTES	(TRACE_ENV_BUCKETS * TRACE_CHANNELS * 3 * 3 / 2)
+#define	TRACE_ENV_TICKS	400	// default: 24 buckets cover 9.6 s
+#define	TRACE_MAX	0xfff
+
+#define	TRACE_CAUSE_ERROR	0x80	// cause: error code | this, or an event code
 
 /*
- * Tracing support routines.
+ * Uncomment for the Trace Test menu item, which aborts with an error
+ * to trigger a trace.
  */
+//#define TRACE_TEST 1
+
+struct trace_hdr {
+	uint16_t seqn;
+	uint8_t period;		// control ticks per sample
+	uint8_t post;		// samples after the trigger
+	uint8_t n;		// samples in the ring
+	uint8_t first;		// oldest of them
+	uint8_t cause;
+	uint8_t env_n;		// envelope buckets in the ring
+	uint16_t env_ticks;	// control ticks per bucket
+	uint8_t env_first;	// oldest bucket
+	uint8_t spare;
+	uint16_t crc;		// of the header up to here, then the ring
+};
+
 void trace_init();
-void trace_trigger();
+void trace_trigger(unsigned char cause);
+void trace_event(unsigned char code);
 bool trace_done();
-void trace_point(int data);
-unsigned int trace_commit();
+void trace_step();
+void trace_run();
+void trace_cmd(const char *what, const char *val);
+void trace_dump();
 bool trace_to_serial(int i);
+
 #endif
@@ -0,0 +1,193 @@
+/*
+ * Interrupt driven ADC sampler.  See adc_sampler.h
+ *
+ * On the host there is no ADC interrupt.  Conversions are polled off
+ * the virtual clock on the same schedule, and read the pin without the
+ * analogRead() cost, which on target the ADC pays in the background.
+ */
+
+#include <Arduino.h>
+#include "state_machine.h"
+#include "adc_sampler.h"
+#include "pin_capture.h"
+#ifndef __AVR__
+#include "host.h"
+#endif
+
+#define	ADC_N_CHANNELS	16
+#define	ADC_LIST_MAX	32
+
+static struct adc_chan {
+	volatile unsigned int val[2];
+	volatile unsigned char seq;	// val[seq & 1] is the newest
+	unsigned char ovs;		// extra bits, 0 for plain samples
+	unsigned char n;		// conversions in sum
+	unsigned int sum;
+} adc_chan[ADC_N_CHANNELS];
+
+static unsigned char adc_list[ADC_LIST_MAX];	// channels in sampling order
+static unsigned char adc_n;
+static unsigned char adc_cur;			// index in adc_list being converted
+static unsigned int adc_mask;			// channels added
+static unsigned char adc_chans[ADC_N_CHANNELS];	// in the order added
+static unsigned char adc_n_chans;
+
+static unsigned char adc_channel(unsigned char pin)
+{
+	return (pin >= A0)? pin - A0: pin;
+}
+
+static inline void adc_store(unsigned int v)
+{
+	struct adc_chan *c = adc_chan + adc_list[adc_cur];
+
+	if (++adc_cur >= adc_n)
+		adc_cur = 0;
+	if (c->ovs) {
+		c->sum += v;
+		if (++c->n < 1 << (2 * c->ovs))
+			return;
+		v = c->sum >> c->ovs;
+		c->sum = 0;
+		c->n = 0;
+	}
+	c->val[(c->seq + 1) & 1] = v;
+	c->seq++;
+}
+
+#ifdef __AVR__
+static inline void adc_mux(unsigned char ch)
+{
+	ADMUX = _BV(REFS0) | (ch & 7);		// AVcc reference, as analogRead()
+	if (ch & 8)
+		ADCSRB |= _BV(MUX5);
+	else
+		ADCSRB &= ~_BV(MUX5);
+}
+
+ISR(ADC_vect)
+{
+	adc_store(ADC);
+	adc_mux(adc_list[adc_cur]);
+	ADCSRA |= _BV(ADSC);
+	pin_capture_scan();	// the captured pins without a pin change interrupt
+}
+#else
+static unsigned long adc_next_us;
+
+static void adc_poll()
+{
+	while (TIME_REACHED(micros(), adc_next_us)) {
+		adc_store(host_adc(A0 + adc_list[adc_cur]));
+		adc_next_us += ADC_CONV_US;
+	}
+}
+#endif
+
+/*
+ * Called from input_setup() for each analog input, with the bits it is
+ * to be oversampled by, 0 to ADC_OVS_MAX.
+ */
+void adc_sampler_add(unsigned char pin, unsigned char ovs)
+{
+	unsigned char ch = adc_channel(pin);
+
+	if (ch >= ADC_N_CHANNELS || (adc_mask & (1U << ch)))
+		return;
+	adc_mask |= 1U << ch;
+	adc_chan[ch].ovs = (ovs > ADC_OVS_MAX)? ADC_OVS_MAX: ovs;
+	adc_chans[adc_n_chans++] = ch;
+}
+
+/*
+ * Called once all inputs are set up.  Builds the sampling order:
+ * ADC_OVS_SLOTS rounds of the oversampled channels, then the others
+ * once.  Returns once every channel has a sample.
+ */
+void adc_sampler_start()
+{
+	unsigned char r, k, ch, rounds;
+
+	adc_n = 0;
+	rounds = 1;
+	for (r = 0; r < ADC_OVS_SLOTS; r++) {
+		for (k = 0; k < adc_n_chans; k++) {
+			ch = adc_chans[k];
+			if (adc_chan[ch].ovs && adc_n < ADC_LIST_MAX)
+				adc_list[adc_n++] = ch;
+			if (r == 0 && adc_chan[ch].ovs &&
+			    (1 << (2 * adc_chan[ch].ovs)) / ADC_OVS_SLOTS > rounds)
+				rounds = (1 << (2 * adc_chan[ch].ovs)) / ADC_OVS_SLOTS;
+		}
+	}
+	for (k = 0; k < adc_n_chans; k++)
+		if (!adc_chan[adc_chans[k]].ovs && adc_n < ADC_LIST_MAX)
+			adc_list[adc_n++] = adc_chans[k];
+	if (adc_n == 0)
+		return;
+	adc_cur = 0;
+#ifdef __AVR__
+	adc_mux(adc_list[0]);
+	ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	ADCSRA |= _BV(ADSC);
+#else
+	adc_next_us = micros() + ADC_CONV_US;
+#endif
+	// the first conversion takes 25 ADC clocks instead of 13
+	delayMicroseconds(ADC_CONV_US * (adc_n * rounds + 1));
+}
+
+/*
+ * Extra bits of an analog pin's samples, 0 if it is not oversampled.
+ */
+unsigned char adc_ovs(unsigned char pin)
+{
+	unsigned char ch = adc_channel(pin);
+
+	return (ch < ADC_N_CHANNELS)? adc_chan[ch].ovs: 0;
+}
+
+/*
+ * Group delay of an analog pin's samples, in microseconds: how far
+ * behind the time it is read a sample's centre is, on average.  A
+ * plain sample is up to one pass of the list old; an oversampled one
+ * averages 4^ovs conversions spread over 4^ovs / ADC_OVS_SLOTS passes,
+ * and is replaced once per window.
+ */
+unsigned long adc_delay_us(unsigned char pin)
+{
+	unsigned char ovs = adc_ovs(pin);
+	unsigned long pass = (unsigned long)adc_n * ADC_CONV_US;
+
+	if (ovs == 0)
+		return pass / 2;
+	return pass * (1 << (2 * ovs)) / ADC_OVS_SLOTS;	// half the window, plus half a window of hold
+}
+
+/*
+ * Latest sample of an analog pin, or -1 if it is not sampled.  An
+ * oversampled pin's are 2^ovs times the ADC counts.
+ * If seq is not NULL it gets the channel's sequence count, which goes
+ * up by one for every sample.
+ */
+int adc_sample(unsigned char pin, unsigned char *seq)
+{
+	unsigned char ch = adc_channel(pin);
+	struct adc_chan *c;
+	unsigned char s;
+	unsigned int v;
+
+	if (ch >= ADC_N_CHANNELS || !(adc_mask & (1U << ch)))
+		return -1;
+#ifndef __AVR__
+	adc_poll();
+#endif
+	c = adc_chan + ch;
+	do {
+		s = c->seq;
+		v = c->val[s & 1];
+	} while (s != c->seq);
+	if (seq)
+		*seq = s;
+	return v;
+}
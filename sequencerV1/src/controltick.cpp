@@ -0,0 +1,190 @@
+/*
+ * Fixed rate control tick.  See controltick.h
+ *
+ * The interrupt only counts, and runs the spark generator (see spark.h).
+ * The control step itself runs from loop(), because check_state()
+ * routines talk to the TFT and the serial port, neither of which can be
+ * used from an interrupt.
+ *
+ * On the host there is no Timer 2.  The tick is polled off the virtual
+ * clock instead, which gives the same schedule.
+ */
+
+#include <Arduino.h>
+#include "state_machine.h"
+#include "controltick.h"
+#include "spark.h"
+#include "serial_queue.h"
+
+#ifdef __AVR__
+#if F_CPU != 16000000L
+#error "controltick assumes a 16 MHz clock"
+#endif
+#if CONTROL_TICK_US <= 1024
+#define	CT_CS		_BV(CS22)		// clk/64, 4 us per count
+#define	CT_US_PER_COUNT	4
+#else
+#define	CT_CS		(_BV(CS22) | _BV(CS21))	// clk/256, 16 us per count
+#define	CT_US_PER_COUNT	16
+#endif
+#if CONTROL_TICK_US % CT_US_PER_COUNT || CONTROL_TICK_US / CT_US_PER_COUNT > 256
+#error "CONTROL_TICK_US cannot be made with timer 2"
+#endif
+#endif
+
+/*
+ * Written by the interrupt.
+ */
+static volatile unsigned long ct_ticks;	// ticks since control_tick_start()
+static volatile unsigned long ct_ms;	// scheduled time of the latest tick
+static volatile unsigned long ct_us;	// same, on the micros() clock
+static unsigned int ct_frac;		// microseconds of ct_ms not yet counted
+
+static inline void ct_tick()
+{
+	ct_us += CONTROL_TICK_US;
+	ct_frac += CONTROL_TICK_US;
+	while (ct_frac >= 1000) {
+		ct_frac -= 1000;
+		ct_ms++;
+	}
+	ct_ticks++;
+	spark_tick(ct_us);
+}
+
+#ifdef __AVR__
+ISR(TIMER2_COMPA_vect)
+{
+	ct_tick();
+}
+#else
+static void ct_poll()
+{
+	while (TIME_REACHED(micros(), ct_us + CONTROL_TICK_US))
+		ct_tick();
+}
+#endif
+
+/*
+ * Statistics
+ */
+static unsigned long ct_done;		// tick count at the last control step
+static unsigned long ct_steps;
+static unsigned long ct_missed;
+static unsigned long ct_max_gap;	// most ticks missed in a row
+static unsigned long ct_late_sum;
+static unsigned int ct_late_min;
+static unsigned int ct_late_max;
+static unsigned long ct_hist[CT_BINS];
+
+void control_tick_reset()
+{
+	ct_steps = 0;
+	ct_missed = 0;
+	ct_max_gap = 0;
+	ct_late_sum = 0;
+	ct_late_min = 0xffff;
+	ct_late_max = 0;
+	memset(ct_hist, 0, sizeof (ct_hist));
+}
+
+/*
+ * Called at the end of setup().
+ */
+void control_tick_start()
+{
+	control_tick_reset();
+
+	noInterrupts();
+	ct_ticks = 0;
+	ct_done = 0;
+	ct_ms = millis();
+	ct_us = micros();
+	ct_frac = 0;
+#ifdef __AVR__
+	TCCR2A = _BV(WGM21);	// CTC, top is OCR2A, OC2B left to spark_tick()
+	TCCR2B = CT_CS;
+	OCR2A = CONTROL_TICK_US / CT_US_PER_COUNT - 1;
+	OCR2B = SPARK_EDGE_US / CT_US_PER_COUNT;
+	TCNT2 = 0;
+	TIFR2 = _BV(OCF2A);
+	TIMSK2 = _BV(OCIE2A);
+#endif
+	interrupts();
+}
+
+/*
+ * Called on every pass through loop().
+ * Returns true when a tick has come since the last control step.
+ * Sets loop_start_t and loop_start_us to the scheduled time of that tick.
+ * Lateness is measured from the scheduled time, so it includes the
+ * interrupt latency.
+ */
+bool control_tick()
+{
+	unsigned long n, ms, us;
+	unsigned long late, gap;
+	unsigned char b;
+
+#ifndef __AVR__
+	ct_poll();
+#endif
+	noInterrupts();
+	n = ct_ticks;
+	ms = ct_ms;
+	us = ct_us;
+	interrupts();
+
+	if (n == ct_done)
+		return false;
+	late = micros() - us;
+	gap = n - ct_done - 1;
+	ct_done = n;
+	loop_start_t = ms;
+	loop_start_us = us;
+
+	ct_steps++;
+	ct_missed += gap;
+	if (gap > ct_max_gap)
+		ct_max_gap = gap;
+	if (late > 0xffff)
+		late = 0xffff;
+	if (late < ct_late_min)
+		ct_late_min = late;
+	if (late > ct_late_max)
+		ct_late_max = late;
+	ct_late_sum += late;
+	for (b = 0, late >>= 3; late && b < CT_BINS - 1; late >>= 1)
+		b++;
+	ct_hist[b]++;
+	return true;
+}
+
+void control_tick_dump()
+{
+	unsigned char b;
+
+	console.print(F("Tick "));
+	console.print(CONTROL_TICK_US);
+	console.print(F(" us, "));
+	console.print(ct_steps);
+	console.print(F(" steps, "));
+	console.print(ct_missed);
+	console.print(F(" missed, at most "));
+	console.print(ct_max_gap);
+	console.println(F(" in a row"));
+	if (ct_steps == 0)
+		return;
+	console.print(F("Late, us: min "));
+	console.print(ct_late_min);
+	console.print(F(" avg "));
+	console.print(ct_late_sum / ct_steps);
+	console.print(F(" max "));
+	console.println(ct_late_max);
+	console.print(F("Bins <8 <16 ... <512 >=512:"));
+	for (b = 0; b < CT_BINS; b++) {
+		console.print(' ');
+		console.print(ct_hist[b]);
+	}
+	console.println();
+}
@@ -5,6 +5,8 @@
 #include <Arduino.h>
 #include <EEPROM.h>
 #include "eepromlocal.h"
+#include "serial_queue.h"
+#include "events.h"
 
 /*
  * Check if EEPROM is OK.
@@ -14,24 +16,32 @@
 bool
 eeprom_check_and_init()
 {
-	unsigned int i;
+	uint16_t i;		// 2 bytes in EEPROM, whatever the size of int
 
 	EEPROM.get(EEPROM_MAGIC, i);
 
 	if (i == 65535UL) {
-		Serial.print("NO MAGIC FOUND.  Initializing to ");
+		console.print("NO MAGIC FOUND.  Initializing to ");
 		i = MY_EEPROM_MAGIC_NUMBER;
-		Serial.println(i);
+		console.println(i);
 		EEPROM.put(EEPROM_MAGIC, i);
 		return false;
 	} else if (i == MY_EEPROM_MAGIC_NUMBER)
 		return false;
+	else if (i == EEPROM_MAGIC_V11) {
+		console.print("Old EEPROM layout.  Clearing the run archive, magic now ");
+		i = MY_EEPROM_MAGIC_NUMBER;
+		console.println(i);
+		event_archive_clear();
+		EEPROM.put(EEPROM_MAGIC, i);
+		return false;
+	}
 
-	Serial.print("Bad EEPROM MAGIC.  Expected ");
-	Serial.print(MY_EEPROM_MAGIC_NUMBER);
-	Serial.print(" got ");
-	Serial.print(i);
-	Serial.print("\n");
+	console.print("Bad EEPROM MAGIC.  Expected ");
+	console.print(MY_EEPROM_MAGIC_NUMBER);
+	console.print(" got ");
+	console.print(i);
+	console.print("\n");
 
 	return true;
 }
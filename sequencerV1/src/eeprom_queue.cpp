@@ -0,0 +1,216 @@
+/*
+ * Background EEPROM writes.  See eeprom_queue.h
+ *
+ * On the host there is no EEPROM ready interrupt.  The queue is polled
+ * off the virtual clock instead, a byte per HOST_EEPROM_WRITE_US, and
+ * written straight to the EEPROM array so the write is not charged to
+ * the loop a second time.
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "state_machine.h"
+#include "serial_queue.h"
+#include "eeprom_queue.h"
+#ifndef __AVR__
+#include "host.h"
+#endif
+
+static struct eeq_job {
+	int addr;
+	unsigned int n;
+	const unsigned char *src;	// NULL: bytes are in data[]
+	unsigned char data[EEQ_INLINE];
+} eeq_jobs[EEQ_JOBS];
+
+static volatile unsigned char eeq_head;	// next job to fill
+static volatile unsigned char eeq_tail;	// job being written
+static volatile unsigned int eeq_done;	// bytes of the tail job written
+static volatile unsigned int eeq_left;	// bytes queued, all jobs
+
+/*
+ * Statistics, for the console
+ */
+static volatile unsigned int eeq_written;	// bytes that needed writing
+static unsigned int eeq_total;		// bytes queued since the queue was last empty
+static unsigned long eeq_start_ms;
+static bool eeq_busy;			// as seen by eeq_run()
+
+/*
+ * Next byte to write, and its address.  Returns false when the queue
+ * is empty.  Called from the interrupt.
+ */
+static bool eeq_next(int *addr, unsigned char *b)
+{
+	struct eeq_job *j;
+
+	for (;;) {
+		if (eeq_tail == eeq_head)
+			return false;
+		j = eeq_jobs + eeq_tail;
+		if (eeq_done < j->n)
+			break;
+		eeq_tail = (eeq_tail + 1) % EEQ_JOBS;
+		eeq_done = 0;
+	}
+	*addr = j->addr + eeq_done;
+	*b = j->src? j->src[eeq_done]: j->data[eeq_done];
+	eeq_done++;
+	eeq_left--;
+	return true;
+}
+
+#ifdef __AVR__
+ISR(EE_READY_vect)
+{
+	int addr;
+	unsigned char b;
+
+	if (!eeq_next(&addr, &b)) {
+		EECR &= ~_BV(EERIE);
+		return;
+	}
+	EEAR = addr;
+	EECR |= _BV(EERE);
+	if (EEDR == b)
+		return;		// still ready, so we are straight back
+	EEDR = b;
+	EECR |= _BV(EEMPE);
+	EECR |= _BV(EEPE);
+	eeq_written++;
+}
+
+static inline void eeq_kick()
+{
+	EECR |= _BV(EERIE);
+}
+#else
+static unsigned long eeq_next_us;
+
+static void eeq_poll()
+{
+	int addr;
+	unsigned char b;
+
+	while (TIME_REACHED(micros(), eeq_next_us)) {
+		if (!eeq_next(&addr, &b))
+			return;
+		if (host_eeprom[addr] == b)
+			continue;
+		host_eeprom[addr] = b;
+		eeq_written++;
+		if (host_model_costs)
+			eeq_next_us += HOST_EEPROM_WRITE_US;
+	}
+}
+
+static inline void eeq_kick()
+{
+	if (eeq_idle())
+		eeq_next_us = micros();
+}
+#endif
+
+bool eeq_idle()
+{
+	bool idle;
+
+	noInterrupts();
+	idle = (eeq_left == 0);
+	interrupts();
+	return idle;
+}
+
+/*
+ * Wait until everything queued is written.
+ */
+void eeq_flush()
+{
+	while (!eeq_idle()) {
+#ifndef __AVR__
+		delayMicroseconds(HOST_EEPROM_WRITE_US);
+		eeq_poll();
+#endif
+	}
+}
+
+void eeq_write(int addr, const void *src, unsigned int n)
+{
+	struct eeq_job *j;
+	unsigned char next;
+
+	if (n == 0)
+		return;
+	next = (eeq_head + 1) % EEQ_JOBS;
+	while (next == eeq_tail) {
+#ifndef __AVR__
+		delayMicroseconds(HOST_EEPROM_WRITE_US);
+		eeq_poll();
+#endif
+	}
+
+#ifndef __AVR__
+	eeq_kick();
+#endif
+	j = eeq_jobs + eeq_head;
+	j->addr = addr;
+	j->n = n;
+	if (n <= EEQ_INLINE) {
+		memcpy(j->data, src, n);
+		j->src = NULL;
+	} else
+		j->src = (const unsigned char *)src;
+
+	if (!eeq_busy) {
+		eeq_busy = true;
+		eeq_total = 0;
+		eeq_written = 0;
+		eeq_start_ms = millis();
+	}
+	eeq_total += n;
+	noInterrupts();
+	eeq_head = next;
+	eeq_left += n;
+	interrupts();
+#ifdef __AVR__
+	eeq_kick();
+#endif
+}
+
+/*
+ * Called from loop() on every pass.
+ */
+void eeq_run()
+{
+#ifndef __AVR__
+	eeq_poll();
+#endif
+	if (!eeq_busy || !eeq_idle())
+		return;
+	eeq_busy = false;
+	console.print(F("EEPROM: "));
+	console.print(eeq_written);
+	console.print(F(" bytes written in "));
+	console.print(millis() - eeq_start_ms);
+	console.println(F(" ms"));
+}
+
+void eeq_dump()
+{
+	unsigned int left;
+
+	noInterrupts();
+	left = eeq_left;
+	interrupts();
+	console.print(F("EEPROM queue: "));
+	if (left == 0) {
+		console.println(F("idle"));
+		return;
+	}
+	console.print(eeq_total - left);
+	console.print(F(" of "));
+	console.print(eeq_total);
+	console.print(F(" bytes done, "));
+	console.print(eeq_written);
+	console.println(F(" written"));
+}
@@ -12,6 +12,8 @@
 #include "trace.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
+#include "serial_queue.h"
 #include <avr/pgmspace.h>    // used to hold text strings in program space.
 
 /*
@@ -58,7 +60,6 @@ const char * const error_messages[] PROGMEM = {
 
 extern char global_msg_buf[16];
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 static unsigned char error_code;	// local copy of error code
@@ -78,6 +79,7 @@ static const struct state *l_restart_state;
 static unsigned char l_restartable;
 static unsigned char last_restartable_error;
 static bool do_entry_stuff;
+static unsigned char cmd_1_edges;	// edge cursor on remote command #1
 
 #define	NO_BLINK	0xff
 #define	BLINK_HALF_PERIOD	500	// half a second on, half a second off.
@@ -104,9 +106,7 @@ static const struct state *i_error_state(unsigned char code)
 		if (l_restartable > 1)
 			l_restartable = 1;
 	}
-#ifdef TRACE_PIN
-	trace_trigger();
-#endif
+	trace_trigger(TRACE_CAUSE_ERROR | code);
 	return &l_error_state;
 }
 
@@ -160,7 +160,7 @@ erEnter()
 	o_daq1->cur_state = off;
 
 	// clear any edge event on remote command #1
-	i_cmd_1->edge = no_edge;
+	edge_skip(i_cmd_1, &cmd_1_edges);
 	do_entry_stuff = true;
 
 	// Initialize blink state machine
@@ -176,20 +176,16 @@ erEnter()
  * we delay the entry manipulation of the screen
  * into the check routine.
  *
- * For this same reason, we delay entry_stuff until any tracing post
- * trigger is complete.
+ * Drawing is queued now, so it no longer costs the 100 ms here, but
+ * the main sequence may have left the display paused.
  */
 static void i_do_entry_stuff()
 {
 	if (!do_entry_stuff)
 		return;
-#ifdef TRACE_PIN
-	if (!trace_done())
-		return;
-	trace_commit();
-#endif // TRACE_PIN
-
 	do_entry_stuff = false;
+	tft.resume();
+	serial_queue_release();
 
 	// background is RED
 	tft.fillScreen(ST7735_RED);
@@ -214,10 +210,9 @@ static void i_do_entry_stuff()
 	}
 
 	/*
-	 * Write the event log to eeprom.
-	 * WARNING: this can take a while.
+	 * Write the event log to eeprom.  This only queues the writes.
 	 */
-	event_commit_conditional();
+	event_commit_conditional(error_code);
 }
 
 void
@@ -228,9 +223,6 @@ erExit()
 	o_amberStatus->cur_state = on;
 	o_greenStatus->cur_state = off;
 	o_daq1->cur_state = off;
-#ifdef TRACE
-	trace_init();
-#endif
 }
 
 /*
@@ -249,10 +241,8 @@ const struct state * erCheck()
 			return tft_menu_machine(&main_menu);
 	}
 
-	if (i_cmd_1->edge == rising && l_restartable == 1 && l_restart_state) {
-		i_cmd_1->edge = no_edge;
+	if (l_restartable == 1 && l_restart_state && edge_rose(i_cmd_1, &cmd_1_edges, NULL))
 		return l_restart_state;
-	}
 
 	// blink the code on the LEDs.
 	// Code is blinked in octal.  RED led blinks the number of 8s, AMBER the number of 1s
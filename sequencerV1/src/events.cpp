@@ -6,6 +6,8 @@
  * The committed event log is written to EEPROM
  */
 
+#include <stddef.h>
+#include <string.h>
 #include "Arduino.h"
 #include "EEPROM.h"
 #include "avr/pgmspace.h"
@@ -16,20 +18,78 @@
 #include "sendtodaq.h"
 #include "eepromlocal.h"
 #include "event_names.h"
+#include "serial_queue.h"
+#include "eeprom_queue.h"
+#include "pressure.h"
+#include "crc16.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "sd_log.h"
+
+// Events are packed into a byte stream, oldest first:
+//	header	code in bits 0-5, number of param bytes (0-2) in bits 6-7
+//	time	time since the previous event (the first: since event_base_us)
+//		in 4 us units, 7 bits per byte, low bits first, top bit set
+//		on all bytes but the last
+//	param	0, 1 or 2 bytes, low byte first
+// or, for a snapshot (param bytes field 3, see event_snap()), 7 bytes:
+//	param	2 bytes, low byte first
+//	press	ig and main pressure, 12 bits each: ig low 8, ig high 4 in
+//		bits 0-3 and main low 4 in bits 4-7, main high 8
+//	outputs	output_bitmap(), 2 bytes, low byte first
+// A state change with no param is 2 bytes, IgPressOK/NAK chatter a tick
+// or a few apart 3 or 4, instead of 6 for the old fixed size records.
+// The buffer is still EVENT_BUFFER_BYTES, about a quarter of the
+// available ram (6KB for static, 2KB for stack)
+//
+// Committed logs are kept in EEPROM, the last EVENT_RUNS of them.  Each
+// is a run_hdr followed by the same packed bytes.  They go one after
+// the other from EEPROM_EVENT_LOG, starting again at the beginning when
+// the next one does not fit before EEPROM_DATA_TRACE.
+//
+// The index at EEPROM_RUN_INDEX has a slot per run, seqn % EVENT_RUNS,
+// giving where the run is.  EEPROM_EVENT_SEQN is the newest run.  A
+// commit first empties the slots of the runs it will overwrite, then
+// writes the run, then its slot, then EEPROM_EVENT_SEQN.  A torn write
+// leaves at worst a slot pointing at a run whose CRC is wrong.
+static unsigned char event_buffer[EVENT_BUFFER_BYTES];
+
+struct run_index {
+	uint16_t seqn;		// NO_RUN if the slot is empty
+	uint16_t addr;
+};
+
+#define	NO_RUN		EVENT_NEWEST
+#define	RUN_CRC_BYTES	offsetof(struct run_hdr, crc)
+
+static_assert(sizeof (struct run_hdr) == 16, "run_hdr is not packed");
+static_assert(sizeof (struct run_hdr) + EVENT_BUFFER_BYTES <= EEPROM_DATA_TRACE - EEPROM_EVENT_LOG,
+	"a full event buffer does not fit in the EEPROM archive");
+
+static struct run_hdr commit_hdr;	// being written by eeprom_queue
 
-// Events are 6 bytes long.  Storing 250 of them takes 1500 bytes.
-// This is about a quarter of the available ram (6KB for static, 2KB for stack)
-static struct event_s {
-	enum event_codes e_e;
-	unsigned int time_e;
-	unsigned int param_e;
-} event_buffer[EVENT_BUFFER_SIZE];
+/*
+ * The committed run is also written to the SD file of the run, from
+ * event_buffer, in the frames runbin sends.  Driven from
+ * event_dump_run(); the file is closed after the last frame.
+ */
+static bool sd_copy;
+static int sd_sent;			// bytes of events written, -1 before the header
+
+static uint16_t selected = NO_RUN;	// run event_to_serial() prints; NO_RUN: the newest
+
+
+static_assert(SparkOff <= EVENT_CODE_MASK, "event code does not fit in the header byte");
+static_assert(EVENT_RUNS <= 8, "event_commit() keeps a bit per run slot");
 
-static struct event_s *e_p;
+static unsigned int e_len;		// bytes used in event_buffer
+static unsigned long e_last_us;		// time of the last event recorded
 
-static unsigned long event_base_t;
+static unsigned long event_base_us;
+static bool have_base;
 
-static int n_events;
+static int n_events;			// recorded
+static int n_dropped;			// not recorded, buffer full
 static bool enabled;
 
 
@@ -39,16 +99,25 @@ static bool enabled;
 void event_init()
 {
 	enabled = false;
-	event_base_t = 0;	// don't have a base time yet.
+	have_base = false;	// don't have a base time yet.
 	n_events = 0;
-	e_p = event_buffer;
+	n_dropped = 0;
+	e_len = 0;
 }
 
 void event_enable()
 {
+	eeq_flush();	// the last commit may still be writing from event_buffer
+	if (sd_copy) {
+		console.println(F("SD copy of the last run cut short"));
+		sd_copy = false;
+	}
+	sdl_open();
 	enabled = true;
 	n_events = 0;
-	e_p = event_buffer;
+	n_dropped = 0;
+	e_len = 0;
+	e_last_us = event_base_us;
 }
 
 void event_disable()
@@ -57,61 +126,239 @@ void event_disable()
 }
 
 /*
- * Called to record an event.
- * Pass in the event.  loop_start_t is used for the timestamp
+ * Start an event record: the header and the time.  Returns where the
+ * rest goes, or NULL if it is not being recorded.
  */
-void event(enum event_codes e, unsigned int p) {
+static unsigned char *event_start(enum event_codes e, unsigned char plen) {
+	unsigned char *b;
+	unsigned long t;
 
+	trace_event(e);
 	if (!enabled)
-		return;
+		return NULL;
 
-	if (event_base_t == 0)
-		event_base_t = loop_start_t;
+	if (!have_base) {
+		event_base_us = loop_start_us;
+		e_last_us = event_base_us;
+		have_base = true;
+	}
 
-	// Record the event if we have space
-	if (n_events < EVENT_BUFFER_SIZE) {
-		e_p->e_e = e;
-		e_p->time_e = loop_start_t - event_base_t;
-		e_p->param_e = p;
-		e_p++;
+	// Record the event if we have space.  Once one is dropped, all
+	// later ones are too, so the log has no holes.
+	if (n_dropped || e_len + EVENT_MAX_BYTES > EVENT_BUFFER_BYTES) {
+		n_dropped++;
+		return NULL;
 	}
 
+	b = event_buffer + e_len;
+	*b++ = e | plen << EVENT_PLEN_SHIFT;
+
+	t = (loop_start_us - e_last_us) / 4;
+	e_last_us += t * 4;
+	while (t >= 0x80) {
+		*b++ = t | 0x80;
+		t >>= 7;
+	}
+	*b++ = t;
+	return b;
+}
+
+static inline void event_end(unsigned char *b) {
+	e_len = b - event_buffer;
 	n_events++;
 }
 
 /*
- * Write the event log to EEPROM
+ * Called to record an event.
+ * Pass in the event.  loop_start_us is used for the timestamp
+ */
+void event(enum event_codes e, unsigned int p) {
+	unsigned char *b;
+	unsigned char plen;
+
+	plen = (p == 0)? 0: (p < 0x100)? 1: 2;
+	b = event_start(e, plen);
+	if (b == NULL)
+		return;
+	if (plen > 0)
+		*b++ = p;
+	if (plen > 1)
+		*b++ = p >> 8;
+	event_end(b);
+}
+
+/*
+ * Record an event with a snapshot of both chamber pressures (filter_a)
+ * and the outputs, as commanded so far this tick.
+ */
+void event_snap(enum event_codes e, unsigned int p) {
+	unsigned char *b;
+	unsigned int ig, main, outs;
+
+	b = event_start(e, EVENT_SNAP);
+	if (b == NULL)
+		return;
+	ig = i_ig_pressure->filter_a;
+	if (ig > EVENT_PRESS_MAX)
+		ig = EVENT_PRESS_MAX;
+	main = i_main_press->filter_a;
+	if (main > EVENT_PRESS_MAX)
+		main = EVENT_PRESS_MAX;
+	outs = output_bitmap();
+	*b++ = p;
+	*b++ = p >> 8;
+	*b++ = ig;
+	*b++ = (ig >> 8) | (main << 4);
+	*b++ = main >> 4;
+	*b++ = outs;
+	*b++ = outs >> 8;
+	event_end(b);
+}
+
+static int run_index_addr(uint16_t seqn)
+{
+	return EEPROM_RUN_INDEX + (seqn % EVENT_RUNS) * sizeof (struct run_index);
+}
+
+/*
+ * Look up a run in the index and read its header.
+ * Does not check the CRC.
+ */
+static bool run_get(uint16_t seqn, struct run_index *ix, struct run_hdr *h)
+{
+	if (seqn == NO_RUN)
+		return false;
+	EEPROM.get(run_index_addr(seqn), *ix);
+	if (ix->seqn != seqn || ix->addr < EEPROM_EVENT_LOG ||
+	    ix->addr + sizeof (*h) > EEPROM_DATA_TRACE)
+		return false;
+	EEPROM.get(ix->addr, *h);
+	return h->seqn == seqn && ix->addr + sizeof (*h) + h->len <= EEPROM_DATA_TRACE;
+}
+
+static bool run_crc_ok(const struct run_index *ix, const struct run_hdr *h)
+{
+	uint16_t crc;
+	int a, end;
+
+	crc = crc16(CRC16_INIT, h, RUN_CRC_BYTES);
+	end = ix->addr + sizeof (*h) + h->len;
+	for (a = ix->addr + sizeof (*h); a < end; a++)
+		crc = crc16_update(crc, EEPROM.read(a));
+	return crc == h->crc;
+}
+
+static uint16_t run_newest()
+{
+	uint16_t seqn;
+
+	EEPROM.get(EEPROM_EVENT_SEQN, seqn);
+	return seqn;
+}
+
+/*
+ * Empty the archive: no newest run and every slot empty.  For an EEPROM
+ * last written with the old layout, before anything is queued.
+ */
+void event_archive_clear()
+{
+	struct run_index ix;
+	uint16_t k;
+
+	ix.seqn = NO_RUN;
+	ix.addr = 0;
+	for (k = 0; k < EVENT_RUNS; k++)
+		EEPROM.put(EEPROM_RUN_INDEX + k * sizeof (ix), ix);
+	EEPROM.put(EEPROM_EVENT_SEQN, ix.seqn);
+}
+
+/*
+ * Step back from seqn to the run before it, or NO_RUN.
+ */
+static uint16_t run_prev(uint16_t seqn)
+{
+	return (seqn == 0)? NO_RUN - 1: seqn - 1;
+}
+
+/*
+ * Write the event log to EEPROM.  The writing is queued and happens in
+ * the background (see eeprom_queue.h); event_buffer is left alone until
+ * it is done.
  *
  * Returns the log sequence number.
  */
-unsigned int event_commit() {
-	int i, n;
-	unsigned int seqn;
+unsigned int event_commit(unsigned char abort_code) {
+	struct run_index ix;
+	struct run_hdr h;
+	uint16_t seqn, start, size, k, end;
+	unsigned char forget;		// bit k: slot k's run is to go
 
 	if (n_events <= 0)
 		return 0xffff;
 
-	// mark the in-eeprom event log as invalid
-	i = 0;
-	EEPROM.put(EEPROM_EVENT_SIZE_2, i);
-
-	// record the size of the event log
-	n = min(n_events, EVENT_BUFFER_SIZE);
-	EEPROM.put(EEPROM_EVENT_SIZE, n);
-	Serial.print("Writing "); Serial.print(n); Serial.print(" events to EEPROM\n");
-	
-	// write the events
-	for (i = 0; i < n; i++)
-		EEPROM.put(EEPROM_EVENT_LOG + i * sizeof (struct event_s),
-				event_buffer[i]);
-
-	// update the log seqn number in eeprom
-	EEPROM.get(EEPROM_EVENT_SEQN, seqn);
-	seqn += 1;
-	EEPROM.put(EEPROM_EVENT_SEQN, seqn);
+	// a commit still being written may change the index
+	eeq_flush();
+
+	// the new run goes after the newest one, if there is room
+	seqn = run_newest();
+	start = EEPROM_EVENT_LOG;
+	if (run_get(seqn, &ix, &h))
+		start = ix.addr + sizeof (h) + h.len;
+	size = sizeof (h) + e_len;
+	if (start + size > EEPROM_DATA_TRACE)
+		start = EEPROM_EVENT_LOG;
+	seqn = (seqn >= NO_RUN - 1)? 0: seqn + 1;
+
+	console.print("Writing "); console.print(n_events); console.print(" events, ");
+	console.print(size); console.print(" bytes to EEPROM as run "); console.println(seqn);
+	if (n_dropped) {
+		console.print(n_dropped); console.print(" events dropped, buffer full\n");
+	}
 
-	EEPROM.put(EEPROM_EVENT_SIZE_2, n);
+	// forget the run in our slot and any we are about to overwrite.
+	// All the reads come first: once a write is queued, the EEPROM
+	// interrupt owns the address register (see eeprom_queue.h).
+	forget = 0;
+	for (k = 0; k < EVENT_RUNS; k++) {
+		EEPROM.get(EEPROM_RUN_INDEX + k * sizeof (ix), ix);
+		if (ix.seqn == NO_RUN)
+			continue;
+		end = ix.addr + sizeof (h);
+		if (ix.addr + sizeof (h) <= EEPROM_DATA_TRACE) {
+			EEPROM.get(ix.addr, h);
+			end += h.len;
+		}
+		if (k == seqn % EVENT_RUNS || (ix.addr < start + size && start < end))
+			forget |= 1 << k;
+	}
+	ix.seqn = NO_RUN;
+	for (k = 0; k < EVENT_RUNS; k++)
+		if (forget & (1 << k))
+			eeq_write(EEPROM_RUN_INDEX + k * sizeof (ix), &ix.seqn, sizeof (ix.seqn));
+
+	commit_hdr.seqn = seqn;
+	commit_hdr.len = e_len;
+	commit_hdr.n_events = n_events;
+	commit_hdr.n_dropped = n_dropped;
+	commit_hdr.zero_ig = zero_ig;
+	commit_hdr.zero_main = zero_main;
+	commit_hdr.abort_code = abort_code;
+	commit_hdr.spare = 0;
+	commit_hdr.crc = crc16(crc16(CRC16_INIT, &commit_hdr, RUN_CRC_BYTES), event_buffer, e_len);
+	eeq_write(start, &commit_hdr, sizeof (commit_hdr));
+	eeq_write(start + sizeof (commit_hdr), event_buffer, e_len);
+
+	ix.seqn = seqn;
+	ix.addr = start;
+	eeq_write(run_index_addr(seqn), &ix, sizeof (ix));
+	eeq_write(EEPROM_EVENT_SEQN, &seqn, sizeof (seqn));
+
+	if (sdl_file()) {
+		sd_copy = true;
+		sd_sent = -1;
+	}
 
+	selected = NO_RUN;
 	return seqn;
 }
 
@@ -120,14 +367,14 @@ unsigned int event_commit() {
  * Does the required checks.
  * Also, sends the seqn to the DAQ.
  */
-void event_commit_conditional() {
-	unsigned int seqn;
+void event_commit_conditional(unsigned char abort_code) {
+	uint16_t seqn;
 
 	if (!enabled || n_events == 0)
 		return;
 
 	enabled = false;
-	seqn = event_commit();
+	seqn = event_commit(abort_code);
 	n_events = 0;
 
 	send_som();
@@ -137,6 +384,80 @@ void event_commit_conditional() {
 }
 
 
+/*
+ * Select the run to print, EVENT_NEWEST for the newest.  Returns false,
+ * and selects nothing, if it is not in the archive.
+ */
+bool event_select(unsigned int seqn)
+{
+	struct run_index ix;
+	struct run_hdr h;
+
+	if (seqn != EVENT_NEWEST && !run_get(seqn, &ix, &h))
+		return false;
+	selected = seqn;
+	return true;
+}
+
+/*
+ * Select the run before (dir < 0) or after (dir > 0) the selected one,
+ * if there is one.  Returns the selected run, NO_RUN if there are none.
+ */
+unsigned int event_select_step(int dir)
+{
+	struct run_index ix;
+	struct run_hdr h;
+	uint16_t newest, s;
+
+	newest = run_newest();
+	s = (selected == NO_RUN)? newest: selected;
+	if (dir < 0 && s != (uint16_t)(newest - (EVENT_RUNS - 1)))
+		event_select(run_prev(s));
+	else if (dir > 0 && s != newest)
+		event_select(s == NO_RUN - 1? 0: s + 1);
+	s = (selected == NO_RUN)? newest: selected;
+	return run_get(s, &ix, &h)? s: NO_RUN;
+}
+
+/*
+ * List the runs in the archive, newest first.
+ * The caller makes sure the EEPROM is not being written.
+ */
+void event_list_runs()
+{
+	struct run_index ix;
+	struct run_hdr h;
+	uint16_t seqn;
+	unsigned char k;
+	bool any = false;
+
+	seqn = run_newest();
+	for (k = 0; k < EVENT_RUNS; k++, seqn = run_prev(seqn)) {
+		if (!run_get(seqn, &ix, &h))
+			continue;
+		any = true;
+		console.print(F("Run "));
+		console.print(seqn);
+		console.print(F(": "));
+		console.print(h.n_events);
+		console.print(F(" events"));
+		if (h.n_dropped) {
+			console.print(F(" ("));
+			console.print(h.n_dropped);
+			console.print(F(" dropped)"));
+		}
+		console.print(F(", abort "));
+		console.print(h.abort_code);
+		console.print(F(", zero "));
+		console.print(h.zero_ig);
+		console.print('/');
+		console.print(h.zero_main);
+		console.println(run_crc_ok(&ix, &h)? F(", ok"): F(", CRC BAD"));
+	}
+	if (!any)
+		console.println(F("No runs in EEPROM."));
+}
+
 /*
  * Write the log to Serial.
  * In order to allow this to be interrupted, we write 1 line at a time.
@@ -144,58 +465,318 @@ void event_commit_conditional() {
  * Returns true when there are no more lines to print.
  * Caller is responsible for starting _i_ at zero and incrementing it.
  * If it returns true on i=0, then no log exists.
+ * The caller makes sure the EEPROM is not being written.
  */
-static int n_eeprom_events;
+static uint16_t n_eeprom_events;
+static int e_rd;			// EEPROM address of the next event
+static int e_rd_end;
+static unsigned long e_rd_us;		// time of the last event printed
 static char buffer[EVENT_MAX_CODE_LENGTH];
 
 bool event_to_serial(int i) {
-	int n;
-	unsigned int seqn;
-	struct event_s l_event;
-	unsigned int l_t;
+	struct run_index ix;
+	struct run_hdr h;
+	uint16_t seqn;
+	unsigned char b, shift, k, plen;
+	unsigned char snap[EVENT_SNAP_BYTES];	// param bytes, and the snapshot
+	unsigned long t;
+	unsigned int param;
+	unsigned long l_t;
 
 
 	// If i=0, print the header and check valid
 	if (i == 0) {
-		EEPROM.get(EEPROM_EVENT_SIZE, n_eeprom_events);
-		EEPROM.get(EEPROM_EVENT_SIZE_2, n);
-		if (n != n_eeprom_events) {
+		seqn = (selected == NO_RUN)? run_newest(): selected;
+		if (!run_get(seqn, &ix, &h)) {
 			n_eeprom_events = 0;
 			return true;
 		}
+		n_eeprom_events = h.n_events;
+		e_rd = ix.addr + sizeof (h);
+		e_rd_end = e_rd + h.len;
+		e_rd_us = 0;
 		
-		EEPROM.get(EEPROM_EVENT_SEQN, seqn);
-		Serial.print("Log #: ");
-		Serial.print(seqn);
-		Serial.print("  has ");
-		Serial.print(n_eeprom_events);
-		Serial.print(" events\n");
+		console_bulk.print("Log #: ");
+		console_bulk.print(seqn);
+		console_bulk.print("  has ");
+		console_bulk.print(n_eeprom_events);
+		console_bulk.print(" events");
+		if (h.n_dropped) {
+			console_bulk.print(", ");
+			console_bulk.print(h.n_dropped);
+			console_bulk.print(" dropped");
+		}
+		console_bulk.print(", abort ");
+		console_bulk.print(h.abort_code);
+		if (!run_crc_ok(&ix, &h))
+			console_bulk.print(", CRC BAD");
+		console_bulk.print("\n");
 		return false;
 	}
 	i -= 1;
 
 	// else print a log event
-	if (i < 0 || i >= n_eeprom_events || i >= EVENT_BUFFER_SIZE)
+	if (i < 0 || i >= n_eeprom_events || e_rd >= e_rd_end)
 		return true;
 
-	EEPROM.get(EEPROM_EVENT_LOG + i * sizeof (struct event_s), l_event);
-	l_t = l_event.time_e;
-	if (l_t < 10000)
-		Serial.print(" ");
-	if (l_t < 1000)
-		Serial.print(" ");
+	b = EEPROM.read(e_rd++);
+	param = b;		// header, for now
+	t = 0;
+	shift = 0;
+	do {
+		b = EEPROM.read(e_rd++);
+		if (shift < 32)
+			t |= (unsigned long)(b & 0x7f) << shift;
+		shift += 7;
+	} while ((b & 0x80) && e_rd < e_rd_end);
+	b = param;
+	plen = b >> EVENT_PLEN_SHIFT;
+	for (k = 0; k < (plen == EVENT_SNAP? EVENT_SNAP_BYTES: plen); k++)
+		snap[k] = EEPROM.read(e_rd++);
+	param = 0;
+	for (k = 0; k < (plen == EVENT_SNAP? 2: plen); k++)
+		param |= (unsigned int)snap[k] << (8 * k);
+	e_rd_us += t * 4;
+
+	// time in ms, to the microsecond
+	l_t = e_rd_us;
+	if (l_t < 100000000UL)
+		console_bulk.print(" ");
+	if (l_t < 10000000UL)
+		console_bulk.print(" ");
+	if (l_t < 1000000UL)
+		console_bulk.print(" ");
+	if (l_t < 100000UL)
+		console_bulk.print(" ");
+	if (l_t < 10000UL)
+		console_bulk.print(" ");
+	console_bulk.print(l_t / 1000);
+	console_bulk.print(".");
+	l_t %= 1000;
 	if (l_t < 100)
-		Serial.print(" ");
+		console_bulk.print("0");
 	if (l_t < 10)
-		Serial.print(" ");
-	Serial.print(l_t);
-	Serial.print(": ");
+		console_bulk.print("0");
+	console_bulk.print(l_t);
+	console_bulk.print(": ");
 
 	// Necessary casts and dereferencing, just copy.
-	strcpy_P(buffer, (char*)pgm_read_word(&(event_code_names[l_event.e_e])));
-	Serial.print(buffer);
-	Serial.print("   ");
-	Serial.println(l_event.param_e);
+	// Codes past the end of the table come from a damaged log.
+	if ((b & EVENT_CODE_MASK) > SparkOff) {
+		console_bulk.print("code ");
+		console_bulk.println(b & EVENT_CODE_MASK);
+		return false;
+	}
+	strcpy_P(buffer, (char*)pgm_read_word(&(event_code_names[b & EVENT_CODE_MASK])));
+	console_bulk.print(buffer);
+	console_bulk.print("   ");
+	if (plen != EVENT_SNAP) {
+		console_bulk.println(param);
+		return false;
+	}
+	console_bulk.print(param);
+	console_bulk.print("  ig ");
+	console_bulk.print(snap[2] | (unsigned int)(snap[3] & 0xf) << 8);
+	console_bulk.print(" main ");
+	console_bulk.print(snap[3] >> 4 | (unsigned int)snap[4] << 4);
+	console_bulk.print(" out ");
+	console_bulk.println(snap[5] | (unsigned int)snap[6] << 8, HEX);
 
 	return false;
 }
+
+/*
+ * Printing a run from the console, a line per loop() like the Dump
+ * Events state does.
+ */
+static int con_line = -1;
+
+void event_dump(unsigned int seqn)
+{
+	if (!event_select(seqn)) {
+		console.println(F("No such run."));
+		return;
+	}
+	con_line = 0;
+}
+
+/*
+ * Binary dump of a run, see events.h.  Driven from event_dump_run().
+ */
+static enum {
+	bin_off,
+	bin_drain,		// waiting for the console to empty, to switch baud
+	bin_settle,		// waiting for the PC to switch
+	bin_send,
+	bin_restore,		// waiting for the frames to go, to switch back
+} bin_phase;
+static unsigned long bin_baud;		// 0: stay at SQ_BAUD
+static unsigned long bin_settle_ms;
+static struct run_hdr bin_hdr;
+static int bin_addr;			// of the packed events
+static int bin_sent;			// bytes of them sent, -1 before the header
+
+void event_dump_bin(unsigned int seqn, unsigned long baud)
+{
+	struct run_index ix;
+
+	if (bin_phase != bin_off) {
+		console.println(F("Binary dump already running."));
+		return;
+	}
+	if (seqn == EVENT_NEWEST)
+		seqn = run_newest();
+	if (!run_get(seqn, &ix, &bin_hdr)) {
+		console.println(F("No such run."));
+		return;
+	}
+	bin_addr = ix.addr + sizeof (bin_hdr);
+	bin_sent = -1;
+	bin_baud = baud;
+	console.print(F("Binary dump of run "));
+	console.print(seqn);
+	console.print(F(", "));
+	console.print(bin_hdr.len);
+	console.print(F(" bytes"));
+	if (baud) {
+		console.print(F(" at "));
+		console.print(baud);
+		console.print(F(" baud"));
+	}
+	console.println();
+	if (baud)
+		telemetry_hold();	// or the queue may never be empty
+	bin_phase = baud? bin_drain: bin_send;
+}
+
+/*
+ * Send the next frame, if there is room.  Returns true after the last.
+ */
+static bool bin_frame()
+{
+	unsigned char body[TM_BODY_MAX];
+	unsigned char n, k;
+	int left;
+
+	n = 0;
+	if (bin_sent < 0) {
+		body[n++] = TM_LOG_HDR;
+		memcpy(body + n, &bin_hdr, sizeof (bin_hdr));
+		n += sizeof (bin_hdr);
+		if (telemetry_frame(body, n))
+			bin_sent = 0;
+		return false;
+	}
+
+	left = bin_hdr.len - bin_sent;
+	if (left > EVENT_BIN_CHUNK)
+		left = EVENT_BIN_CHUNK;
+	body[n++] = TM_LOG_DATA;
+	body[n++] = bin_hdr.seqn;
+	body[n++] = bin_hdr.seqn >> 8;
+	body[n++] = bin_sent;
+	body[n++] = bin_sent >> 8;
+	for (k = 0; k < left; k++)
+		body[n++] = EEPROM.read(bin_addr + bin_sent + k);
+	if (telemetry_frame(body, n))
+		bin_sent += left;
+	return bin_sent >= bin_hdr.len;
+}
+
+static void event_bin_run()
+{
+	switch (bin_phase) {
+	    case bin_drain:
+		if (!serial_queue_idle())
+			return;
+		serial_queue_baud(bin_baud);
+		bin_settle_ms = millis() + EVENT_BIN_SETTLE_MS;
+		bin_phase = bin_settle;
+		break;
+	    case bin_settle:
+		if (TIME_REACHED(millis(), bin_settle_ms))
+			bin_phase = bin_send;
+		break;
+	    case bin_send:
+		if (!eeq_idle() || !bin_frame())
+			return;
+		if (bin_baud) {
+			bin_phase = bin_restore;
+			return;
+		}
+		bin_phase = bin_off;
+		console.println(F("Done sending log"));
+		break;
+	    case bin_restore:
+		if (!serial_queue_idle())
+			return;
+		serial_queue_baud(SQ_BAUD);
+		telemetry_release();
+		bin_phase = bin_off;
+		console.println(F("Done sending log"));
+		break;
+	}
+}
+
+/*
+ * Write the next frame of the committed run to the SD file, if there is
+ * room.
+ */
+static void event_sd_run()
+{
+	unsigned char body[TM_BODY_MAX];
+	unsigned char n;
+	int left;
+
+	if (!sdl_file()) {
+		sd_copy = false;	// the card failed
+		return;
+	}
+	if (sdl_room() < TM_WIRE_MAX)
+		return;
+	n = 0;
+	if (sd_sent < 0) {
+		body[n++] = TM_LOG_HDR;
+		memcpy(body + n, &commit_hdr, sizeof (commit_hdr));
+		n += sizeof (commit_hdr);
+		if (sdl_frame(body, n))
+			sd_sent = 0;
+		return;
+	}
+
+	left = commit_hdr.len - sd_sent;
+	if (left > EVENT_BIN_CHUNK)
+		left = EVENT_BIN_CHUNK;
+	body[n++] = TM_LOG_DATA;
+	body[n++] = commit_hdr.seqn;
+	body[n++] = commit_hdr.seqn >> 8;
+	body[n++] = sd_sent;
+	body[n++] = sd_sent >> 8;
+	memcpy(body + n, event_buffer + sd_sent, left);
+	n += left;
+	if (!sdl_frame(body, n))
+		return;
+	sd_sent += left;
+	if (sd_sent >= commit_hdr.len) {
+		sd_copy = false;
+		sdl_close();
+	}
+}
+
+/*
+ * Called from loop() on every pass.
+ */
+void event_dump_run()
+{
+	if (sd_copy)
+		event_sd_run();
+	if (bin_phase != bin_off)
+		event_bin_run();
+	if (con_line < 0 || !eeq_idle() || console_bulk.availableForWrite() < SQ_LINE)
+		return;
+	if (event_to_serial(con_line)) {
+		con_line = -1;
+		console_bulk.println("Done printing log");
+	} else
+		con_line++;
+}
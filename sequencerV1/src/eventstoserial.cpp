@@ -1,5 +1,6 @@
 /*
  * This code dumps the events to the serial console
+ * Joystick left and right pick an older or newer run.
  */
 
 #include <Arduino.h>
@@ -10,8 +11,10 @@
 #include "events.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
+#include "serial_queue.h"
+#include "eeprom_queue.h"
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 static void eventDumpEnter();
@@ -23,6 +26,8 @@ static unsigned char was_safe;
 static bool running;
 static bool was_running;
 static int event_line;
+static bool run_shown;
+static unsigned char push_1_edges;	// edge cursor on button 1
 
 /*
  * Want both switches to safe.
@@ -70,6 +75,27 @@ static void eventDumpDisplay()
 	tft.print(running? "running": "done   ");
 }
 
+/*
+ * Show which run is being dumped.
+ */
+static void eventDumpShowRun(unsigned int seqn)
+{
+	int y;
+
+	y = 2 * TM_TXT_HEIGHT+16+TM_TXT_OFFSET;
+	tft.fillRect(20, y, 140, TM_TXT_HEIGHT, TM_TXT_BKG_COLOR);
+	tft.setTextSize(TM_TXT_SIZE);
+	tft.setTextColor(TM_TXT_FG_COLOR);
+	tft.setCursor(20, y);
+	if (seqn == EVENT_NEWEST)
+		tft.print(F("No runs"));
+	else {
+		tft.print(F("Run "));
+		tft.print(seqn);
+	}
+	run_shown = true;
+}
+
 /*
  * Local to opto test
  * On entry, clear screen and write message
@@ -92,8 +118,11 @@ void eventDumpEnter()
 	was_running = true;
 
 	event_line = 0;
-	i_push_1->edge = no_edge;
+	edge_skip(i_push_1, &push_1_edges);
 	was_safe = 0;
+
+	event_select(EVENT_NEWEST);
+	run_shown = false;
 }
 
 /*
@@ -112,15 +141,26 @@ const struct state * eventDumpCheck()
 	if (!safe_ok())
 		return current_state;
 
-	if (i_push_1->edge == rising) {
-		i_push_1->edge = no_edge;
+	if (edge_rose(i_push_1, &push_1_edges, NULL)) {
 		running = !running;
 	}
 
-	if (running) {
+	// the EEPROM cannot be read while it is being written
+	if (!eeq_idle())
+		return current_state;
+
+	if (joystick_edge_value == JOY_LEFT || joystick_edge_value == JOY_RIGHT) {
+		eventDumpShowRun(event_select_step(joystick_edge_value == JOY_LEFT? -1: 1));
+		event_line = 0;
+		running = true;
+	} else if (!run_shown)
+		eventDumpShowRun(event_select_step(0));
+
+	// one line per pass, when the queue has room for it
+	if (running && console_bulk.availableForWrite() >= SQ_LINE) {
 		if (event_to_serial(event_line)) {
 			running = false;
-			Serial.println("Done printing log");
+			console_bulk.println("Done printing log");
 		} else
 			event_line += 1;
 	}
@@ -9,8 +9,8 @@
 #include "io_ref.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 void flowTestEnter();
@@ -71,7 +71,7 @@ static void flowButtonDisplay()
 		tft.fillRect(0, 96, 64, 32, c);	// erase the display spot
 		tft.setCursor(4, 100);
 		tft.print(F("N2O"));
-		ols1 = ls2;
+		ols2 = ls2;
 	}
 
 	if (ls1 != ols1) {
@@ -20,10 +20,9 @@
 #include "pressure.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
-extern long spark_bias;
 
 void igLRTestEnter();
 void igLRDebugEnter();
@@ -177,7 +176,6 @@ void common_test_enter()
 	igTestDisplay();
 	igThisTest = current_state;
 	error_set_restartable(false);
-	spark_bias = 0;
 }
 
 /*
@@ -328,9 +326,7 @@ const struct state * igLongTestRunCheck()
 {
 	unsigned long t;
 
-	t = loop_start_t - state_enter_t;
-	if (loop_start_t < state_enter_t)
-		t = 0;
+	t = loop_start_us - state_enter_us;
 
 	// If joystick, or button 2, return to menu system.
 	if (joystick_edge_value == JOY_PRESS ||
@@ -343,7 +339,7 @@ const struct state * igLongTestRunCheck()
 		return &igLongTestEntry;
 	
 	// If the waiting period is over, then run the next test.
-	if (test_count == 1 || t > TIME_BETWEEN)
+	if (test_count == 1 || t > US(TIME_BETWEEN))
 		return &runIgDebug;
 
 	return current_state;
@@ -8,6 +8,7 @@
 #include "io_ref.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
 /*
  * Define ON_TIME to some number of milliseconds to make the
@@ -16,7 +17,6 @@
  */
 //#define	ON_TIME	5000	// 5 seconds
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 void igValveTestEnter();
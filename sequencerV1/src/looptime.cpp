@@ -0,0 +1,267 @@
+/*
+ * Loop timing instrumentation.  See looptime.h
+ *
+ * Printing goes out one character at a time, only as fast as the
+ * serial transmit buffer has room, so asking for the numbers does not
+ * change them.  Collection is paused while printing so the report is
+ * a consistent snapshot.
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "state_machine.h"
+#include "looptime.h"
+#include "serial_queue.h"
+
+#ifdef LOOPTIME
+
+#define	LT_TOTAL	lt_n_phases	// index of the whole-loop statistic
+
+struct lt_stat {
+	uint16_t min;	// microseconds, saturates at 65535
+	uint16_t max;
+	uint32_t sum;
+};
+
+static struct lt_slot {
+	const struct state *s;
+	uint32_t n;
+	struct lt_stat ph[lt_n_phases + 1];
+	uint16_t hist[LT_BINS];		// whole loop time
+} slots[LT_N_STATES];
+
+static uint16_t phase_hist[lt_n_phases][LT_BINS];
+
+static struct lt_slot *cur;	// slot for the state at the top of this loop
+static uint32_t t_start;
+static uint32_t t_last;
+static bool dumping;
+
+static const char * const lt_phase_str[lt_n_phases + 1] = {
+	"serial",
+	"cmd",
+	"inputs",
+	"joystick",
+	"check",
+	"outputs",
+	"tft",
+	"eeprom",
+	"sd",
+	"dump",
+	"loop",
+};
+
+/*
+ * Histogram bin for a time in microseconds.
+ */
+static unsigned char lt_bin(uint32_t d)
+{
+	unsigned char b = 0;
+
+	d >>= 4;
+	while (d && b < LT_BINS - 1) {
+		d >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static void lt_count(uint16_t *h, uint32_t d)
+{
+	h += lt_bin(d);
+	if (*h != 0xffff)
+		(*h)++;
+}
+
+static void lt_record(struct lt_stat *st, uint32_t d)
+{
+	uint16_t d16 = (d > 0xffff)? 0xffff: d;
+
+	if (d16 < st->min)
+		st->min = d16;
+	if (d16 > st->max)
+		st->max = d16;
+	st->sum += d;
+}
+
+void looptime_reset()
+{
+	memset(slots, 0, sizeof (slots));
+	memset(phase_hist, 0, sizeof (phase_hist));
+	dumping = false;
+	cur = NULL;
+}
+
+/*
+ * Called at the top of loop().
+ * Finds (or claims) the slot for the current state.
+ */
+void looptime_start()
+{
+	unsigned char i;
+	unsigned char p;
+	struct lt_slot *sl;
+
+	cur = NULL;
+	if (dumping)
+		return;
+
+	for (i = 0; i < LT_N_STATES; i++) {
+		sl = slots + i;
+		if (sl->s == current_state || i == LT_N_STATES - 1)
+			break;
+		if (sl->s == NULL) {
+			sl->s = current_state;
+			break;
+		}
+	}
+	if (sl->n == 0) {
+		if (sl->s == NULL)
+			sl->s = current_state;
+		for (p = 0; p <= lt_n_phases; p++)
+			sl->ph[p].min = 0xffff;
+	}
+	cur = sl;
+	t_start = t_last = micros();
+}
+
+/*
+ * Called after each phase of loop().
+ */
+void looptime_phase(enum lt_phase p)
+{
+	uint32_t now;
+
+	if (!cur)
+		return;
+	now = micros();
+	lt_record(&cur->ph[p], now - t_last);
+	lt_count(phase_hist[p], now - t_last);
+	t_last = now;
+}
+
+/*
+ * Called at the bottom of loop().
+ */
+void looptime_end()
+{
+	uint32_t d;
+
+	if (!cur)
+		return;
+	d = micros() - t_start;
+	lt_record(&cur->ph[LT_TOTAL], d);
+	lt_count(cur->hist, d);
+	if (cur->n != 0xffffffffUL)
+		cur->n++;
+	cur = NULL;
+}
+
+/*
+ * Report.
+ * The report is a sequence of rows.  Each slot in use has a title row,
+ * a row per phase and a histogram row.  Then come the per-phase
+ * histograms and a closing row.  Rows of unused slots are empty.
+ */
+#define	LT_SLOT_ROWS	(lt_n_phases + 3)
+
+static char lt_line[80];
+static unsigned char lt_pos;
+static int lt_row;
+
+static int lt_hist_line(int n, const uint16_t *h)
+{
+	unsigned char b;
+
+	for (b = 0; b < LT_BINS; b++)
+		n += snprintf(lt_line + n, sizeof (lt_line) - n, " %u", (unsigned int)h[b]);
+	return n;
+}
+
+/*
+ * Format row r into lt_line.  Returns false when there are no more rows.
+ */
+static bool lt_format(int r)
+{
+	struct lt_slot *sl;
+	struct lt_stat *st;
+	int n;
+
+	lt_line[0] = 0;
+	if (r == 0) {
+		snprintf(lt_line, sizeof (lt_line),
+			"Loop times, us.  Bins <16 <32 ... <4096 >=4096\n");
+		return true;
+	}
+	r -= 1;
+
+	if (r < LT_N_STATES * LT_SLOT_ROWS) {
+		sl = slots + r / LT_SLOT_ROWS;
+		r %= LT_SLOT_ROWS;
+		if (sl->n == 0)
+			return true;	// empty line, skipped
+		if (r == 0) {
+			snprintf(lt_line, sizeof (lt_line), "%s%s: %lu loops\n",
+				sl->s->name,
+				(sl == slots + LT_N_STATES - 1)? " and later states": "",
+				(unsigned long)sl->n);
+		} else if (r <= lt_n_phases + 1) {
+			st = sl->ph + r - 1;
+			snprintf(lt_line, sizeof (lt_line), "  %-8s min %u avg %lu max %u\n",
+				lt_phase_str[r - 1], (unsigned int)st->min,
+				(unsigned long)(st->sum / sl->n), (unsigned int)st->max);
+		} else {
+			n = snprintf(lt_line, sizeof (lt_line), "  hist    ");
+			n = lt_hist_line(n, sl->hist);
+			snprintf(lt_line + n, sizeof (lt_line) - n, "\n");
+		}
+		return true;
+	}
+	r -= LT_N_STATES * LT_SLOT_ROWS;
+
+	if (r < lt_n_phases) {
+		n = snprintf(lt_line, sizeof (lt_line), "%-8s", lt_phase_str[r]);
+		n = lt_hist_line(n, phase_hist[r]);
+		snprintf(lt_line + n, sizeof (lt_line) - n, "\n");
+		return true;
+	}
+	if (r == lt_n_phases) {
+		snprintf(lt_line, sizeof (lt_line), "Done printing loop times\n");
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Start printing the report.
+ */
+void looptime_dump()
+{
+	dumping = true;
+	lt_row = 0;
+	lt_pos = 0;
+	lt_format(0);
+}
+
+/*
+ * Called once per loop.  Sends as much of the report as fits in the
+ * serial transmit buffer without waiting.
+ */
+void looptime_to_serial()
+{
+	if (!dumping)
+		return;
+
+	while (console_bulk.availableForWrite() > 0) {
+		if (lt_line[lt_pos]) {
+			console_bulk.write(lt_line[lt_pos++]);
+			continue;
+		}
+		lt_pos = 0;
+		if (!lt_format(++lt_row)) {
+			dumping = false;
+			return;
+		}
+	}
+}
+#endif
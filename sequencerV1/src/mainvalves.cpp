@@ -11,11 +11,11 @@
 #include "io_ref.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 #include <Servo.h>
 
 //#define	TS_HACK			// run the servos in parallel.  Used for testing servo slew rates
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 void mainValveTestEnter();
@@ -1,6 +1,8 @@
 #include <Arduino.h>
 #include "state_machine.h"
 #include "io_ref.h"
+#include "serial_queue.h"
+#include "spark.h"
 
 /*
  * Panic routine.
@@ -8,6 +10,8 @@
  */
 
 void myPanic(const char *msg) {
+    spark_stop();		// before anything that can take time
+    serial_queue_flush();
     Serial.print("PANIC: ");
     Serial.println(msg);
     digitalWrite(o_redStatus->pin, HIGH);
@@ -0,0 +1,139 @@
+/*
+ * Interrupt side capture of digital inputs.  See pin_capture.h
+ *
+ * pin_capture_scan() is the interrupt side.  It runs from the pin change
+ * vectors, from the ADC conversion interrupt, and on the host from
+ * host_pin_hook, and looks at every captured pin.
+ */
+
+#include <Arduino.h>
+#include "pin_capture.h"
+#ifndef __AVR__
+#include "host.h"
+#endif
+
+static struct cap_pin {
+	unsigned char pin;
+#ifdef __AVR__
+	volatile uint8_t *in;		// its PINx register
+	unsigned char mask;
+#endif
+	volatile unsigned char level;	// raw, as of the latest change
+	volatile unsigned char changes;	// mod 256
+	volatile unsigned long t_us;	// micros() of the latest change
+	unsigned char seen;		// changes, as of the last pin_capture_read()
+} cap[CAPTURE_MAX];
+static unsigned char n_cap;
+
+static inline unsigned char cap_level(struct cap_pin *c)
+{
+#ifdef __AVR__
+	return (*c->in & c->mask) != 0;
+#else
+	return digitalRead(c->pin);
+#endif
+}
+
+void pin_capture_scan()
+{
+	struct cap_pin *c;
+	unsigned char l;
+
+	for (c = cap; c < cap + n_cap; c++) {
+		l = cap_level(c);
+		if (l != c->level) {
+			c->level = l;
+			c->changes++;
+			c->t_us = micros();
+		}
+	}
+}
+
+#ifdef __AVR__
+ISR(PCINT0_vect)
+{
+	pin_capture_scan();
+}
+
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#else
+static void cap_hook(uint8_t pin)
+{
+	pin_capture_scan();
+}
+#endif
+
+/*
+ * Called from input_setup() for each captured input, after its pinMode.
+ * False if there is no room.
+ */
+bool pin_capture_add(unsigned char pin)
+{
+	struct cap_pin *c;
+
+	if (n_cap >= CAPTURE_MAX)
+		return false;
+	c = cap + n_cap;
+	c->pin = pin;
+#ifdef __AVR__
+	c->in = portInputRegister(digitalPinToPort(pin));
+	c->mask = digitalPinToBitMask(pin);
+#endif
+	c->level = cap_level(c);
+	c->changes = 0;
+	c->seen = 0;
+	c->t_us = micros();
+	n_cap++;
+	return true;
+}
+
+/*
+ * Called once all inputs are set up.  Pins with a pin change interrupt
+ * get it; the rest are left to the ADC interrupt's calls.
+ */
+void pin_capture_start()
+{
+#ifdef __AVR__
+	unsigned char k, pin;
+
+	for (k = 0; k < n_cap; k++) {
+		pin = cap[k].pin;
+		if (digitalPinToPCICR(pin) == NULL)
+			continue;
+		*digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+		*digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
+	}
+#else
+	host_pin_hook = &cap_hook;
+#endif
+}
+
+/*
+ * The raw level of a captured pin and the micros() of its latest
+ * change.  True if it has changed since the last call, however many
+ * times.  A pin that is not captured is just read, and never changed.
+ */
+bool pin_capture_read(unsigned char pin, unsigned char *level, unsigned long *t_us)
+{
+	struct cap_pin *c;
+	unsigned char n;
+
+	for (c = cap; c < cap + n_cap; c++)
+		if (c->pin == pin)
+			break;
+	if (c == cap + n_cap) {
+		*level = digitalRead(pin);
+		*t_us = micros();
+		return false;
+	}
+	noInterrupts();
+	*level = c->level;
+	*t_us = c->t_us;
+	n = c->changes;
+	interrupts();
+	if (n == c->seen)
+		return false;
+	c->seen = n;
+	return true;
+}
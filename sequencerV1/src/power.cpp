@@ -11,8 +11,8 @@
 #include "io_ref.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 #define	LOWER_DISP	100	// where to put display of inputs.
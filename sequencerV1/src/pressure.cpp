@@ -12,8 +12,8 @@
 #include "pressure.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 void pressureSensorTestEnter();
@@ -0,0 +1,61 @@
+/*
+ * RAM use on the Mega.  See ram.h
+ *
+ * The linker symbols are avr-libc's: .data starts at __data_start, .bss
+ * ends at __bss_end, the heap starts at __heap_start and malloc() has
+ * taken it up to __brkval, 0 if never called.  On the host there is
+ * nothing to measure.
+ */
+
+#include <Arduino.h>
+#include "ram.h"
+#include "serial_queue.h"
+
+#ifdef __AVR__
+extern char __data_start, __bss_end, __heap_start;
+extern char *__brkval;
+
+static char *heap_end()
+{
+	return (__brkval != 0)? __brkval: &__heap_start;
+}
+
+/*
+ * Fill from the heap to a little below our own frame.  An interrupt
+ * frame below SP is gone by the time we write over it.
+ */
+void ram_paint()
+{
+	char *p, *sp = (char *)SP - 16;
+
+	for (p = heap_end(); p < sp; p++)
+		*p = RAM_PAINT;
+}
+
+void ram_dump()
+{
+	char *p, *top = (char *)SP;
+
+	for (p = heap_end(); p < top && *(unsigned char *)p == RAM_PAINT; p++)
+		;
+	console.print(F("RAM: static "));
+	console.print((unsigned int)(&__bss_end - &__data_start));
+	console.print(F(", heap "));
+	console.print((unsigned int)(heap_end() - &__heap_start));
+	console.print(F(", stack now "));
+	console.print((unsigned int)(RAMEND - SP));
+	console.print(F(", most "));
+	console.print((unsigned int)(RAMEND + 1 - (unsigned int)p));
+	console.print(F(", never used "));
+	console.println((unsigned int)(p - heap_end()));
+}
+#else
+void ram_paint()
+{
+}
+
+void ram_dump()
+{
+	console.println(F("RAM use is only measured on the Mega."));
+}
+#endif
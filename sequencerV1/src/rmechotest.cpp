@@ -10,8 +10,8 @@
 #include "io_ref.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 void rmEchoTestEnter();
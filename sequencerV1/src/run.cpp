@@ -51,16 +51,15 @@
 #include "tft_menu.h"
 #include "io_ref.h"
 #include "events.h"
+#include "spark.h"
 #include "mainvalves.h"
 #include "pressure.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
 #define	DAQ1PRESSURE	1    // put state of pressure sensor on daq1 line.
 
-extern void spark_run();
-extern Adafruit_ST7735 tft;
-extern long spark_bias;
 
 /*
  * Report variables
@@ -139,7 +138,6 @@ void runMainExit()
 void runStartEnter()
 {
 	test_start_t = millis();
-	spark_bias = test_start_t;
 	rep_n_samples = 0;
 	rep_max_pressure = 0;
 	rep_sum_pressure = 0;
@@ -321,11 +319,11 @@ const struct state * runIgPressCheck()
 	}
 
 	// t is how long we've been in this state
-	t = loop_start_t - state_enter_t;
+	t = loop_start_us - state_enter_us;
 
 	// If no ignition and too much time has passed, give up with an error
-	if (t > ig_pressure_time)
-		return error_state(errorIgNoIg, (unsigned int)t);
+	if (t > US(ig_pressure_time))
+		return error_state(errorIgNoIg, (unsigned int)(t / 1000));
 	
 	// keep waiting
 	return current_state;
@@ -444,15 +442,15 @@ const struct state * runIgDebugCheck()
 		return es;
 
 	// t is how long we've been in this state
-	t = loop_start_t - state_enter_t;
+	t = loop_start_us - state_enter_us;
 
-	if (t >= ig_spark_time && t < ig_spark_off_time)
+	if (t >= US(ig_spark_time) && t < US(ig_spark_off_time))
 		spark_run();
 
-	if (t >= ig_n2o_time)
+	if (t >= US(ig_n2o_time))
 		o_n2oIgValve->cur_state = on;
 
-	if (t >= ig_ipa_time)
+	if (t >= US(ig_ipa_time))
 		o_ipaIgValve->cur_state = on;
 
 	// p is the filtered pressure (counts * 4)
@@ -467,7 +465,7 @@ const struct state * runIgDebugCheck()
 #endif
 
 	// Run for a fixed length of time.
-	if (t > ig_run_time)
+	if (t > US(ig_run_time))
 		return &shutdown;
 	
 	// keep waiting
@@ -492,9 +490,9 @@ const struct state * shutdownCheck()
 	unsigned long t;
 	extern const struct state *igThisTest;
 
-	t = loop_start_t - state_enter_t;
+	t = loop_start_us - state_enter_us;
 
-	if (t > shutdown_timeout)
+	if (t > US(shutdown_timeout))
 		return igThisTest;
 	return current_state;
 }
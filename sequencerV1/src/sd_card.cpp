@@ -0,0 +1,388 @@
+/*
+ * Raw SD card blocks.  See sd_card.h
+ *
+ * SPI mode, as in the SD simplified physical layer spec: CMD0 to
+ * reset, CMD8 to tell version 2 cards from version 1, ACMD41 until the
+ * card is ready, CMD58 for block (SDHC) or byte addressing, CMD9 for
+ * the size.  Writes are single block CMD24s, reads CMD17.  The card
+ * ignores the CRC after CMD0 and CMD8.
+ *
+ * On the host the card is the file host_sd_image, created with
+ * HOST_SD_BLOCKS blocks if it does not exist.  A block costs the
+ * virtual clock HOST_SD_XFER_US, a share per piece, and the card stays
+ * busy for HOST_SD_BUSY_US after.
+ */
+
+#include <Arduino.h>
+#include <string.h>
+#include "sd_card.h"
+#ifndef __AVR__
+#include <stdio.h>
+#include "host.h"
+#endif
+
+static unsigned long sd_n_blocks;	// 0: no card
+static bool sd_writing;			// a write may still be programming
+static bool sd_refused;			// the last write was not accepted
+
+/*
+ * The block being sent, SD_PIECE bytes per sd_busy() call.
+ */
+static const unsigned char *sd_src;
+static unsigned int sd_src_n;
+static unsigned int sd_sent;		// bytes of the block, data then zeros
+static bool sd_xfer;			// sending; the card has the bus
+static void sd_send();
+
+#ifdef __AVR__
+#include <SPI.h>
+
+#define	SD_CMD0		0	// GO_IDLE_STATE
+#define	SD_CMD8		8	// SEND_IF_COND
+#define	SD_CMD9		9	// SEND_CSD
+#define	SD_CMD16	16	// SET_BLOCKLEN
+#define	SD_CMD17	17	// READ_SINGLE_BLOCK
+#define	SD_CMD24	24	// WRITE_BLOCK
+#define	SD_CMD55	55	// APP_CMD
+#define	SD_CMD58	58	// READ_OCR
+#define	SD_ACMD41	41	// SD_SEND_OP_COND
+
+#define	SD_R1_IDLE	0x01
+#define	SD_TOKEN	0xfe	// start of a data block
+#define	SD_INIT_MS	1000
+#define	SD_READ_MS	300
+
+#define	SD_SPCR_SLOW	(_BV(SPE) | _BV(MSTR) | _BV(SPR1) | _BV(SPR0))	// 125 kHz, to start
+#define	SD_SPCR_FAST	(_BV(SPE) | _BV(MSTR))				// with SPI2X, 8 MHz
+
+static bool sd_hc;			// addressed in blocks, not bytes
+static unsigned char sd_spcr = SD_SPCR_SLOW, sd_spsr;
+static unsigned char dpy_spcr, dpy_spsr;	// the display's, while the card has the bus
+
+static void sd_select()
+{
+	dpy_spcr = SPCR;
+	dpy_spsr = SPSR;
+	SPCR = sd_spcr;
+	SPSR = sd_spsr;
+	digitalWrite(SD_CS, LOW);
+}
+
+static void sd_deselect()
+{
+	digitalWrite(SD_CS, HIGH);
+	SPI.transfer(0xff);
+	SPCR = dpy_spcr;
+	SPSR = dpy_spsr;
+}
+
+static bool sd_wait(unsigned char want, unsigned int ms)
+{
+	unsigned long start = millis();
+
+	while (SPI.transfer(0xff) != want)
+		if (millis() - start >= ms)
+			return false;
+	return true;
+}
+
+static unsigned char sd_cmd(unsigned char cmd, unsigned long arg)
+{
+	unsigned char r, i;
+
+	if (cmd != SD_CMD0)
+		sd_wait(0xff, SD_READ_MS);
+	SPI.transfer(0x40 | cmd);
+	SPI.transfer(arg >> 24);
+	SPI.transfer(arg >> 16);
+	SPI.transfer(arg >> 8);
+	SPI.transfer(arg);
+	SPI.transfer((cmd == SD_CMD0)? 0x95: (cmd == SD_CMD8)? 0x87: 0x01);
+	for (i = 0; i < 10; i++)
+		if (!((r = SPI.transfer(0xff)) & 0x80))
+			break;
+	return r;
+}
+
+static unsigned char sd_acmd(unsigned char cmd, unsigned long arg)
+{
+	sd_cmd(SD_CMD55, 0);
+	return sd_cmd(cmd, arg);
+}
+
+static bool sd_start()
+{
+	unsigned long start, c_size;
+	unsigned char r, i, v2, b[16];
+
+	start = millis();
+	while (sd_cmd(SD_CMD0, 0) != SD_R1_IDLE)
+		if (millis() - start >= SD_INIT_MS)
+			return false;
+
+	v2 = false;
+	if (sd_cmd(SD_CMD8, 0x1aa) == SD_R1_IDLE) {
+		for (i = 0; i < 4; i++)
+			b[i] = SPI.transfer(0xff);
+		if (b[3] != 0xaa)
+			return false;
+		v2 = true;
+	}
+	while ((r = sd_acmd(SD_ACMD41, v2? 0x40000000UL: 0)) != 0)
+		if ((r & ~SD_R1_IDLE) || millis() - start >= SD_INIT_MS)
+			return false;
+
+	sd_hc = false;
+	if (v2) {
+		if (sd_cmd(SD_CMD58, 0) != 0)
+			return false;
+		for (i = 0; i < 4; i++)
+			b[i] = SPI.transfer(0xff);
+		sd_hc = (b[0] & 0x40) != 0;
+	}
+	if (!sd_hc && sd_cmd(SD_CMD16, SD_BLOCK) != 0)
+		return false;
+
+	if (sd_cmd(SD_CMD9, 0) != 0 || !sd_wait(SD_TOKEN, SD_READ_MS))
+		return false;
+	for (i = 0; i < 16; i++)
+		b[i] = SPI.transfer(0xff);
+	SPI.transfer(0xff);
+	SPI.transfer(0xff);
+	if ((b[0] >> 6) == 1) {
+		c_size = (unsigned long)(b[7] & 0x3f) << 16 | (unsigned int)b[8] << 8 | b[9];
+		sd_n_blocks = (c_size + 1) << 10;
+	} else {
+		c_size = (unsigned long)(b[6] & 3) << 10 | (unsigned int)b[7] << 2 | b[8] >> 6;
+		r = ((b[9] & 3) << 1 | b[10] >> 7) + 2 + (b[5] & 0xf) - 9;	// log2 blocks per c_size unit
+		sd_n_blocks = (c_size + 1) << r;
+	}
+	return true;
+}
+
+/*
+ * Called from setup(), before the display is started.
+ */
+bool sd_init()
+{
+	unsigned char i;
+	bool ok;
+
+	pinMode(SD_CS, OUTPUT);
+	digitalWrite(SD_CS, HIGH);
+	SPI.begin();
+
+	// at least 74 clocks with the card deselected to wake it
+	sd_spcr = SD_SPCR_SLOW;
+	sd_spsr = 0;
+	dpy_spcr = SPCR;
+	dpy_spsr = SPSR;
+	SPCR = sd_spcr;
+	SPSR = sd_spsr;
+	for (i = 0; i < 10; i++)
+		SPI.transfer(0xff);
+	SPCR = dpy_spcr;
+	SPSR = dpy_spsr;
+
+	sd_select();
+	ok = sd_start();
+	sd_deselect();
+	if (!ok)
+		sd_n_blocks = 0;
+	sd_spcr = SD_SPCR_FAST;
+	sd_spsr = _BV(SPI2X);
+	return ok;
+}
+
+bool sd_write(unsigned long lba, const void *src, unsigned int n)
+{
+	if (lba >= sd_n_blocks || n > SD_BLOCK || sd_xfer)
+		return false;
+	sd_select();
+	if (sd_cmd(SD_CMD24, sd_hc? lba: lba << 9) != 0) {
+		sd_deselect();
+		return false;
+	}
+	SPI.transfer(0xff);
+	SPI.transfer(SD_TOKEN);
+	sd_src = (const unsigned char *)src;
+	sd_src_n = n;
+	sd_sent = 0;
+	sd_refused = false;
+	sd_xfer = true;
+	sd_send();
+	return true;
+}
+
+/*
+ * Send the next piece of the block.  After the last, the CRC and the
+ * card's answer, and the bus goes back to the display.
+ */
+static void sd_send()
+{
+	unsigned int end = sd_sent + SD_PIECE;
+	unsigned char r;
+
+	if (end > SD_BLOCK)
+		end = SD_BLOCK;
+	for (; sd_sent < end; sd_sent++)
+		SPI.transfer((sd_sent < sd_src_n)? sd_src[sd_sent]: 0);
+	if (sd_sent < SD_BLOCK)
+		return;
+	SPI.transfer(0xff);	// CRC, not checked
+	SPI.transfer(0xff);
+	r = SPI.transfer(0xff);
+	sd_deselect();
+	sd_xfer = false;
+	sd_refused = (r & 0x1f) != 0x05;	// data not accepted
+	sd_writing = !sd_refused;
+}
+
+bool sd_busy()
+{
+	if (sd_xfer) {
+		sd_send();
+		return true;
+	}
+	if (!sd_writing)
+		return false;
+	sd_select();
+	sd_writing = SPI.transfer(0xff) != 0xff;
+	sd_deselect();
+	return sd_writing;
+}
+
+bool sd_read(unsigned long lba, void *dst, unsigned int n)
+{
+	unsigned char *p = (unsigned char *)dst;
+	unsigned int i;
+	bool ok;
+
+	if (lba >= sd_n_blocks || n > SD_BLOCK || sd_xfer)
+		return false;
+	sd_select();
+	ok = sd_wait(0xff, SD_READ_MS) &&
+	     sd_cmd(SD_CMD17, sd_hc? lba: lba << 9) == 0 &&
+	     sd_wait(SD_TOKEN, SD_READ_MS);
+	if (ok) {
+		for (i = 0; i < SD_BLOCK + 2; i++) {
+			if (i < n)
+				p[i] = SPI.transfer(0xff);
+			else
+				SPI.transfer(0xff);
+		}
+	}
+	sd_deselect();
+	sd_writing = false;
+	return ok;
+}
+#else
+static FILE *sd_f;
+static uint64_t sd_busy_until;
+static unsigned long sd_lba;
+
+bool sd_init()
+{
+	long size;
+
+	if (host_sd_image == NULL)
+		return false;
+	sd_f = fopen(host_sd_image, "r+b");
+	if (!sd_f)
+		sd_f = fopen(host_sd_image, "w+b");
+	if (!sd_f) {
+		perror(host_sd_image);
+		return false;
+	}
+	fseek(sd_f, 0, SEEK_END);
+	size = ftell(sd_f);
+	if (size < (long)HOST_SD_BLOCKS * SD_BLOCK) {
+		fseek(sd_f, (long)HOST_SD_BLOCKS * SD_BLOCK - 1, SEEK_SET);
+		fputc(0, sd_f);
+		size = (long)HOST_SD_BLOCKS * SD_BLOCK;
+	}
+	sd_n_blocks = size / SD_BLOCK;
+	return true;
+}
+
+bool sd_write(unsigned long lba, const void *src, unsigned int n)
+{
+	if (lba >= sd_n_blocks || n > SD_BLOCK || sd_xfer)
+		return false;
+	sd_lba = lba;
+	sd_src = (const unsigned char *)src;
+	sd_src_n = n;
+	sd_sent = 0;
+	sd_refused = false;
+	sd_xfer = true;
+	sd_send();
+	return true;
+}
+
+/*
+ * The file is written when the last piece has been paid for, from
+ * src as it is then, so a caller that changes it too soon finds out.
+ */
+static void sd_send()
+{
+	static const unsigned char zeros[SD_BLOCK] = {0};
+	unsigned int n = SD_BLOCK - sd_sent;
+
+	if (n > SD_PIECE)
+		n = SD_PIECE;
+	if (host_model_costs)
+		host_advance_us((uint32_t)HOST_SD_XFER_US * n / SD_BLOCK);
+	sd_sent += n;
+	if (sd_sent < SD_BLOCK)
+		return;
+	fseek(sd_f, (long)sd_lba * SD_BLOCK, SEEK_SET);
+	fwrite(sd_src, 1, sd_src_n, sd_f);
+	fwrite(zeros, 1, SD_BLOCK - sd_src_n, sd_f);
+	fflush(sd_f);
+	if (host_model_costs)
+		sd_busy_until = host_now_us + HOST_SD_BUSY_US;
+	sd_xfer = false;
+	sd_writing = true;
+}
+
+bool sd_busy()
+{
+	if (sd_xfer) {
+		sd_send();
+		return true;
+	}
+	if (sd_writing && host_now_us >= sd_busy_until)
+		sd_writing = false;
+	return sd_writing;
+}
+
+bool sd_read(unsigned long lba, void *dst, unsigned int n)
+{
+	if (lba >= sd_n_blocks || n > SD_BLOCK || sd_xfer)
+		return false;
+	if (sd_busy())
+		host_now_us = sd_busy_until;	// waits for the write, as on target
+	if (host_model_costs)
+		host_advance_us(HOST_SD_XFER_US);
+	fseek(sd_f, (long)lba * SD_BLOCK, SEEK_SET);
+	if (fread(dst, 1, n, sd_f) != n)
+		memset(dst, 0, n);
+	sd_writing = false;
+	return true;
+}
+#endif
+
+unsigned long sd_blocks()
+{
+	return sd_n_blocks;
+}
+
+bool sd_sending()
+{
+	return sd_xfer;
+}
+
+bool sd_write_refused()
+{
+	return sd_refused;
+}
@@ -0,0 +1,302 @@
+/*
+ * Run files on the SD card.  See sd_log.h
+ */
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <string.h>
+#include "serial_queue.h"
+#include "telemetry.h"
+#include "sd_log.h"
+#include "crc16.h"
+
+#define	SDL_SUPER_CRC_BYTES	offsetof(struct sdl_super, crc)
+
+static_assert(SDL_SUPER_CRC_BYTES == 16, "sdl_super is not packed");
+static_assert(sizeof (struct sdl_blk) + SDL_DATA <= SD_BLOCK, "block data does not fit");
+static_assert(SDL_SPILL <= SDL_DATA, "spill is more than a block");
+static_assert(sizeof (struct sdl_super) <= SD_PIECE, "super block must go in the first piece");
+
+static enum {
+	sdl_off,		// no card, or it failed
+	sdl_closed,		// no file open
+	sdl_active,		// taking writes
+	sdl_closing,		// sending the last blocks, then the super block
+} sdl_state;
+
+static struct sdl_super sb;		// as it is on the card, or is to be
+static bool sb_dirty;
+static bool open_next;			// sdl_open() while closing
+
+/*
+ * The block being filled, with the spill after it.  It is sent from
+ * here once full, and the spill moves down to start the next.
+ */
+static unsigned char blk[sizeof (struct sdl_blk) + SDL_DATA + SDL_SPILL];
+static unsigned char *const blk_data = blk + sizeof (struct sdl_blk);
+static unsigned int blk_len;		// bytes of file data in blk
+static unsigned char spill_len;
+static bool blk_full;
+static bool blk_sent;			// it has gone to sd_write()
+
+static unsigned long busy_since;	// ms, the last write
+static unsigned long file_bytes;
+static unsigned int file_blocks;
+static unsigned long n_blocks;		// written since power up
+static unsigned long n_refused;		// writes that did not fit
+
+static void sdl_fail(const __FlashStringHelper *why)
+{
+	console.print(F("SD card "));
+	console.print(why);
+	console.println(F(", logging stopped"));
+	sdl_state = sdl_off;
+}
+
+static void sdl_advance()
+{
+	if (++sb.next >= sd_blocks()) {
+		sb.next = 1;
+		sb.wrapped = 1;
+	}
+}
+
+/*
+ * Called from setup(), before the display is started.  Waits for the
+ * card; a file left open is found by reading a block header per block.
+ */
+void sdl_init()
+{
+	struct sdl_blk h;
+	unsigned long n;
+
+	sdl_state = sdl_off;
+	if (!sd_init() || sd_blocks() < 2)
+		return;
+	if (!sd_read(0, &sb, sizeof (sb)) || sb.magic != SDL_MAGIC ||
+	    sb.crc != crc16(CRC16_INIT, &sb, SDL_SUPER_CRC_BYTES) || sb.next >= sd_blocks()) {
+		memset(&sb, 0, sizeof (sb));	// new card, or not one of ours
+		sb.magic = SDL_MAGIC;
+		sb.next = 1;
+		sb_dirty = true;
+	} else if (sb.open) {
+		for (n = 1; n < sd_blocks(); n++) {
+			if (!sd_read(sb.next, &h, sizeof (h)) || h.file != sb.file || h.len > SDL_DATA)
+				break;
+			sdl_advance();
+		}
+		sb.open = 0;
+		sb_dirty = true;
+	}
+	sdl_state = sdl_closed;
+	console.print(F("SD card: "));
+	console.print(sd_blocks());
+	console.print(F(" blocks, newest file "));
+	console.println(sb.file);
+}
+
+/*
+ * Start a new file.  Closes the open one, if any.
+ */
+void sdl_open()
+{
+	if (sdl_state == sdl_active)
+		sdl_close();
+	if (sdl_state == sdl_closing) {
+		open_next = true;
+		return;
+	}
+	if (sdl_state != sdl_closed)
+		return;
+	sb.file = (sb.file >= 0xfffe)? 1: sb.file + 1;
+	sb.first = sb.next;
+	sb.open = 1;
+	sb_dirty = true;
+	blk_len = 0;
+	spill_len = 0;
+	blk_full = false;
+	file_bytes = 0;
+	file_blocks = 0;
+	sdl_state = sdl_active;
+}
+
+/*
+ * Close the open file.  Its last blocks are still to be written.
+ */
+void sdl_close()
+{
+	if (sdl_state == sdl_active)
+		sdl_state = sdl_closing;
+}
+
+/*
+ * The number of the open file, 0 if none.
+ */
+unsigned int sdl_file()
+{
+	return (sdl_state == sdl_active)? sb.file: 0;
+}
+
+/*
+ * Bytes sdl_write() would take now.
+ */
+unsigned int sdl_room()
+{
+	if (sdl_state != sdl_active)
+		return 0;
+	if (blk_full)
+		return SDL_SPILL - spill_len;
+	return SDL_DATA - blk_len + SDL_SPILL;
+}
+
+/*
+ * Append n bytes to the open file, all of them or, returning false,
+ * none.
+ */
+bool sdl_write(const void *src, unsigned char n)
+{
+	if (sdl_state != sdl_active)
+		return false;
+	if (!blk_full) {
+		if (blk_len + n <= SDL_DATA) {
+			memcpy(blk_data + blk_len, src, n);
+			blk_len += n;
+			file_bytes += n;
+			return true;
+		}
+		blk_full = true;
+	}
+	if (spill_len + n > SDL_SPILL) {
+		n_refused++;
+		return false;
+	}
+	memcpy(blk_data + SDL_DATA + spill_len, src, n);
+	spill_len += n;
+	file_bytes += n;
+	return true;
+}
+
+/*
+ * Frame a body of len bytes as telemetry_frame() does and append it.
+ * The body has room for the CRC after len.
+ */
+bool sdl_frame(unsigned char *body, unsigned char len)
+{
+	unsigned char wire[TM_WIRE_MAX];
+
+	if (sdl_state != sdl_active)
+		return false;
+	return sdl_write(wire, telemetry_encode(body, len, wire));
+}
+
+/*
+ * Called from loop() on every pass.  Does at most one write.
+ */
+void sdl_run()
+{
+	struct sdl_blk *h = (struct sdl_blk *)blk;
+
+	if (sdl_state == sdl_off)
+		return;
+	if (sd_busy()) {
+		if (!sd_sending() && millis() - busy_since > SDL_TIMEOUT_MS)
+			sdl_fail(F("not responding"));
+		return;
+	}
+	if (sd_write_refused()) {
+		sdl_fail(F("write failed"));
+		return;
+	}
+
+	// the block is on the card; the spill starts the next
+	if (blk_sent) {
+		blk_sent = false;
+		sdl_advance();
+		n_blocks++;
+		file_blocks++;
+		memmove(blk_data, blk_data + SDL_DATA, spill_len);
+		blk_len = spill_len;
+		spill_len = 0;
+		blk_full = false;
+	}
+
+	if (blk_full || (sdl_state == sdl_closing && blk_len > 0)) {
+		h->file = sb.file;
+		h->len = blk_len;
+		if (!sd_write(sb.next, blk, sizeof (*h) + blk_len)) {
+			sdl_fail(F("write failed"));
+			return;
+		}
+		busy_since = millis();
+		blk_sent = true;
+		return;
+	}
+
+	if (sdl_state == sdl_closing) {
+		sb.open = 0;
+		sb_dirty = true;
+		sdl_state = sdl_closed;
+		console.print(F("SD file "));
+		console.print(sb.file);
+		console.print(F(": "));
+		console.print(file_bytes);
+		console.print(F(" bytes in "));
+		console.print(file_blocks);
+		console.println(F(" blocks"));
+	}
+
+	if (sb_dirty) {
+		sb.crc = crc16(CRC16_INIT, &sb, SDL_SUPER_CRC_BYTES);
+		if (!sd_write(0, &sb, sizeof (sb))) {
+			sdl_fail(F("write failed"));
+			return;
+		}
+		busy_since = millis();
+		sb_dirty = false;
+		return;
+	}
+
+	if (open_next) {
+		open_next = false;
+		sdl_open();
+	}
+}
+
+void sdl_cmd(const char *arg)
+{
+	if (arg != NULL && strcmp(arg, "open") == 0) {
+		sdl_open();
+		return;
+	}
+	if (arg != NULL && strcmp(arg, "close") == 0) {
+		sdl_close();
+		return;
+	}
+
+	if (sdl_state == sdl_off) {
+		console.println(F("No SD card."));
+		return;
+	}
+	console.print(F("SD card "));
+	console.print(sd_blocks());
+	console.print(F(" blocks, next "));
+	console.print(sb.next);
+	if (sb.wrapped)
+		console.print(F(" (wrapped)"));
+	console.print(F(", "));
+	console.print(n_blocks);
+	console.print(F(" written, "));
+	console.print(n_refused);
+	console.println(F(" writes refused"));
+	console.print(F("File "));
+	console.print(sb.file);
+	if (sdl_state == sdl_closed) {
+		console.println(F(" closed"));
+		return;
+	}
+	console.print((sdl_state == sdl_closing)? F(" closing, "): F(" open, "));
+	console.print(file_bytes);
+	console.print(F(" bytes, "));
+	console.print(file_blocks);
+	console.println(F(" blocks written"));
+}
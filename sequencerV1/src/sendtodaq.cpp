@@ -77,6 +77,8 @@ static void send_start()
 static void send_end()
 {
 	set_lines(0);
+	output_forget(o_daq0);	// update_outputs() puts them back
+	output_forget(o_daq1);
 }
 
 static void send8(unsigned char c)
@@ -76,15 +76,23 @@
 #include "tft_menu.h"
 #include "io_ref.h"
 #include "events.h"
+#include "spark.h"
 #include "mainvalves.h"
 #include "pressure.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
+#include "serial_queue.h"
 
 #define	SEQ_REP_PULSE_WIDTH	10	// width, in ms, of pulse output on both daq lines at end of run.
 
-extern void spark_run();
-extern Adafruit_ST7735 tft;
+/*
+ * Sequence timers run off loop_start_us, so phase times are good to the
+ * control tick rather than to the millisecond.  Parameters stay in ms.
+ * The whole sequence is well inside the 35 minutes that unsigned
+ * differences of micros() times are good for.
+ */
+
 extern struct menu main_menu;
 
 void sequenceEntryEnter();
@@ -120,6 +128,7 @@ struct state sequenceReport = { "sequenceReport", &sequenceReportEnter, &sequenc
 static bool was_power;	// true if last iteration we displayed the power error message
 static bool was_safe;	// true if last iteration we displayed the safe error message
 static bool enter_screen_redraw;	// used to force screen redraw
+static unsigned char i2_edges;	// edge cursor on I2, the fire / abort button
 
 static bool safe_ok()
 {
@@ -147,17 +156,25 @@ static bool power_ok()
 const struct state *
 allAborts()
 {
-	unsigned int p;
+	unsigned int p, t;
+	const struct input *by = NULL;
 
-	// Operator aborts
-	if (joystick_edge_value == JOY_PRESS ||
-			I2->edge == rising ||
+	// Operator aborts, and how long since the button was pressed
+	if (edge_rose(I2, &i2_edges, &t))
+		by = I2;
 #ifndef LOCAL_RUN
-			i_push_2->current_val ||
+	else if (i_push_2->current_val)
+		by = i_push_2;
 #endif
-			i_push_1->current_val) {
-		I2->edge = no_edge;
+	else if (i_push_1->current_val)
+		by = i_push_1;
+	else if (joystick_edge_value == JOY_PRESS)
+		by = i_joystick;
+	if (by != NULL) {
+		if (by != I2)
+			t = edge_last(by);
 		event(OpAbort, 1);
+		event(OpLatency, edge_age(t));
 		return error_state(errorSeqOpAbort);
 	}
 
@@ -197,7 +214,7 @@ allAborts()
 
 	// abort if pressure sensor broken
 	if (!MAIN_PRESSURE_VALID(p)) {
-/*xxx*/Serial.print("MAIN ABORT:  p=");Serial.print(p);Serial.print("  min_pressure=");Serial.println(min_pressure);
+/*xxx*/console_urgent.print("MAIN ABORT:  p=");console_urgent.print(p);console_urgent.print("  min_pressure=");console_urgent.println(min_pressure);
 		event(MainPressFail, p);
 		return error_state(errorMainNoPressure, p);
 	}
@@ -246,7 +263,7 @@ void sequenceEntryEnter()
 	enter_screen_redraw = true;	// force screen redraw
 	was_safe = false;
 	was_power = false;
-	I2->edge = no_edge;
+	edge_skip(I2, &i2_edges);
 
 	error_set_restart(&sequenceEntry);
 	error_set_restartable(true);
@@ -280,7 +297,7 @@ void sequenceEntryExit() {
  */
 const struct state * sequenceEntryCheck()
 {
-	unsigned int p;
+	unsigned int p, t;
 	extern const struct state * current_state;
 
 	if (joystick_edge_value == JOY_PRESS)
@@ -311,9 +328,9 @@ const struct state * sequenceEntryCheck()
 		return error_state(errorMainPressureInsane, p);
 
 	if (!MAIN_PRESSURE_VALID(p)) {
-/*xxx*/Serial.print("MAIN ABORT 2:  p=");Serial.print(p);Serial.print("  min_pressure=");Serial.print(min_pressure);
-/*xxx*/Serial.print("  i_main_press->filter_a = ");Serial.println(i_main_press->filter_a);
-/*xxx*/Serial.print("  pin = ");Serial.println(i_main_press->pin);
+/*xxx*/console_urgent.print("MAIN ABORT 2:  p=");console_urgent.print(p);console_urgent.print("  min_pressure=");console_urgent.print(min_pressure);
+/*xxx*/console_urgent.print("  i_main_press->filter_a = ");console_urgent.println(i_main_press->filter_a);
+/*xxx*/console_urgent.print("  pin = ");console_urgent.println(i_main_press->pin);
 		return error_state(errorMainNoPressure, p);
 	}
 
@@ -373,7 +390,9 @@ const struct state * sequenceEntryCheck()
 		event_enable();
 		event(IgZero, zero_ig);
 		event(MainZero, zero_main);
-		I2->edge = no_edge; // sequence will abort of rising edge of I2
+		// sequence will abort on the next rising edge of I2, not this one
+		if (edge_rose(I2, &i2_edges, &t))
+			event(OpLatency, edge_age(t));
 		return &sequenceIgLight;
 	}
 
@@ -400,10 +419,14 @@ void
 sequenceIgLightEnter()
 {
 	/*
-	 * This call takes about 100 ms, which is annoying
-	 * Net effect is that ignition is delayed by this amount.
+	 * Erasing the screen takes about 100 ms.  It is queued, and the
+	 * display is paused until the burn is over, so it does not delay
+	 * ignition.  Console output is held too: what does not fit in the
+	 * queue is dropped rather than waited for.
 	 */
 	tft.fillScreen(TM_TXT_BKG_COLOR);
+	tft.pause();
+	serial_queue_hold();
 
 	o_greenStatus->cur_state = pulse_on;	// set to blinking green
 	o_amberStatus->cur_state = on;
@@ -442,9 +465,9 @@ const struct state *sequenceIgLightCheck()
 		 * This code is moved out of the entry routine to ensure a reasonable loop_start_t
 		 * Otherwise, the screen erase runs for 100 ms and loop_start_t is 100 ms out of date.
 		 */
-		event(IgStart, 0);
-		sequence_time = loop_start_t;
-		sequence_phase_time = loop_start_t;
+		event_snap(IgStart, 0);
+		sequence_time = loop_start_us;
+		sequence_phase_time = loop_start_us;
 		light_enter = false;
 
 		/*
@@ -457,35 +480,35 @@ const struct state *sequenceIgLightCheck()
 	}
 
 	// how long have we been in this state?
-	t = loop_start_t - sequence_phase_time;
+	t = loop_start_us - sequence_phase_time;
 
 	// Time to crack the main valves a bit?
-	if (!mv_cracked && t >= mv_crack_time) {
+	if (!mv_cracked && t >= US(mv_crack_time)) {
 		mv_cracked = true;
-		event(MvSlack, 0);
+		event_snap(MvSlack, 0);
 		mainIPACrack();
 		mainN2OCrack();
 	}
 
 	// turn on the igniter IPA valve?
-	if (!ig_ipa_on && t >= ig_ipa_time) {
+	if (!ig_ipa_on && t >= US(ig_ipa_time)) {
 		ig_ipa_on = true;
-		event(IgIPA, 0);
+		event_snap(IgIPA, 0);
 		o_ipaIgValve->cur_state = on;
 	}
 	
 	// turn on the igniter N2O valve?
-	if (!ig_n2o_on && t >= ig_n2o_time) {
+	if (!ig_n2o_on && t >= US(ig_n2o_time)) {
 		ig_n2o_on = true;
-		event(IgN2O, 0);
+		event_snap(IgN2O, 0);
 		o_n2oIgValve->cur_state = on;
 	}
 	
 	// turn on the spark?
-	if (t >= ig_spark_time) {
+	if (t >= US(ig_spark_time)) {
 		if (!ig_spark_on) {
 			ig_spark_on = true;
-			event(IgSpark, 0);
+			event_snap(IgSpark, 0);
 		}
 		spark_run();
 	}
@@ -514,7 +537,7 @@ sequenceIgPressureEnter()
 {
 	o_daq0->cur_state = off;
 	o_daq1->cur_state = off;		// state #2, even, daq1 is off.
-	sequence_phase_time = loop_start_t;
+	sequence_phase_time = loop_start_us;
 	pressstate = pressNoPress;
 	o_ipaIgValve->cur_state = on;
 	o_n2oIgValve->cur_state = on;
@@ -550,7 +573,7 @@ sequenceIgPressureCheck()
 			spark_run();
 			if (pressGood) {
 				event(IgPressOK, p);
-				pressstate_time = loop_start_t;
+				pressstate_time = loop_start_us;
 				pressstate = pressWaitSpark;
 			}
 			break;
@@ -559,12 +582,12 @@ sequenceIgPressureCheck()
 			spark_run();
 			if (!pressGood) {
 				event(IgPressNAK, p);
-				pressstate_time = loop_start_t;
+				pressstate_time = loop_start_us;
 				pressstate = pressNoPress;
-			} else if (loop_start_t - pressstate_time >= ig_stable_spark) {
+			} else if (loop_start_us - pressstate_time >= US(ig_stable_spark)) {
 				event(IgPressStable, p);
-				event(IgSparkOff, 0);
-				pressstate_time = loop_start_t;
+				event_snap(IgSparkOff, 0);
+				pressstate_time = loop_start_us;
 				pressstate = pressWaitNoSpark;
 			}
 			break;
@@ -572,19 +595,19 @@ sequenceIgPressureCheck()
 		case pressWaitNoSpark:
 			if (!pressGood) {
 				event(IgPressNAK, p);
-				event(IgFail0, 0);
+				event_snap(IgFail0, 0);
 				return error_state(errorIgFlameOut);
-			} else if (loop_start_t - pressstate_time >= ig_stable_no_spark) {
-				time_M = loop_start_t;
-				event(IgStable, p);
+			} else if (loop_start_us - pressstate_time >= US(ig_stable_no_spark)) {
+				time_M = loop_start_us;
+				event_snap(IgStable, p);
 				return &sequenceMainValvesStart;
 			}
 			break;
 	}
 	
 	// if the igniter doesn't fire and stabilize within 500 ms, give up.
-	if (loop_start_t - sequence_phase_time > ig_pressure_time) {
-		event(IgFail1, p);
+	if (loop_start_us - sequence_phase_time > US(ig_pressure_time)) {
+		event_snap(IgFail1, p);
 		return error_state(errorIgNoIg);
 	}
 
@@ -601,11 +624,11 @@ sequenceMainValvesStartEnter()
 {
 	o_daq0->cur_state = off;
 	o_daq1->cur_state = on;			// state #3, odd, daq1 is on.
-	sequence_phase_time = loop_start_t;
+	sequence_phase_time = loop_start_us;
 	closeMainOnExit = true;
 	mainIPAIsOpen = false;
 	mainN2OIsOpen = false;
-	pressstate_time = loop_start_t;
+	pressstate_time = loop_start_us;
 	mainPressWasGood = false;
 	o_ipaIgValve->cur_state = on;
 	o_n2oIgValve->cur_state = on;
@@ -626,7 +649,7 @@ sequenceMainValvesStartExit()
 const struct state *
 sequenceMainValvesStartCheck()
 {
-	unsigned int t;
+	unsigned long t;
 	unsigned int p;
 	const struct state *es;
 
@@ -636,11 +659,11 @@ sequenceMainValvesStartCheck()
 
 	p = i_ig_pressure->filter_a;
 	if (IG_PRESSURE_LESS_THAN(p, good_pressure_PSI)) {
-		event(IgFail2, p);
+		event_snap(IgFail2, p);
 		return error_state(errorIgFlameOut, p);
 	}
 
-	t = loop_start_t - pressstate_time;
+	t = loop_start_us - pressstate_time;
 	p = i_main_press->filter_a;
 	if (MAIN_PRESSURE_LESS_THAN(p, main_good_pressure_PSI)) {
 		if (mainPressWasGood) {
@@ -649,7 +672,7 @@ sequenceMainValvesStartCheck()
 		}
 	} else {
 		if (mainPressWasGood) {
-			if (t >= main_stable_time) {
+			if (t >= US(main_stable_time)) {
 				// Success!
 				closeMainOnExit = false;
 				return &sequenceMVFull;
@@ -657,19 +680,19 @@ sequenceMainValvesStartCheck()
 		} else {
 			event(MainPartialOK, p);
 			mainPressWasGood = true;
-			pressstate_time = loop_start_t;
+			pressstate_time = loop_start_us;
 		}
 	}
 
 
 	// if no success by M+400, give up
-	t = loop_start_t - time_M;
-	if (t >= main_pressure_time) {
-		event(MainFail0, p);
+	t = loop_start_us - time_M;
+	if (t >= US(main_pressure_time)) {
+		event_snap(MainFail0, p);
 #ifdef NOMAINFAIL
 			event(MainPartialOK, p);
 			mainPressWasGood = true;
-			pressstate_time = loop_start_t;
+			pressstate_time = loop_start_us;
 				closeMainOnExit = false;
 				return &sequenceMVFull;
 #else
@@ -678,15 +701,15 @@ sequenceMainValvesStartCheck()
 	}
 
 	// sequence opening the main valves
-	if (!mainIPAIsOpen && t >= main_IPA_open_time) {
-		event(MvIPAStart, 0);
+	if (!mainIPAIsOpen && t >= US(main_IPA_open_time)) {
+		event_snap(MvIPAStart, 0);
 		mainIPAPartial();
 		mainIPAIsOpen = true;
 		error_set_restartable(false);
 	}
 
-	if (!mainN2OIsOpen && t >= main_N2O_open_time) {
-		event(MvN2OStart, 0);
+	if (!mainN2OIsOpen && t >= US(main_N2O_open_time)) {
+		event_snap(MvN2OStart, 0);
 		mainN2OPartial();
 		mainN2OIsOpen = true;
 		error_set_restartable(false);
@@ -702,11 +725,11 @@ sequenceMVFullEnter()
 {
 	o_daq0->cur_state = off;
 	o_daq1->cur_state = off;		// state #4, even, daq1 is off.
-	full_time = loop_start_t;
+	full_time = loop_start_us;
 	o_ipaIgValve->cur_state = on;
 	o_n2oIgValve->cur_state = on;
 	error_set_restartable(false);
-	event(MvFull, 0);
+	event_snap(MvFull, 0);
 	mainN2OOpen();
 	mainIPAOpen();
 }
@@ -717,7 +740,7 @@ sequenceMVFullExit()
 	o_daq0->cur_state = on;			// Set daq0 on error exit.
 	o_daq1->cur_state = off;
 	event(IgIPAClose, 0);
-	event(SequenceDone, 0);
+	event_snap(SequenceDone, 0);
 	o_ipaIgValve->cur_state = off;
 	o_n2oIgValve->cur_state = off;
 	mainIPAClose();
@@ -725,6 +748,8 @@ sequenceMVFullExit()
 	o_greenStatus->cur_state = off;
 	o_amberStatus->cur_state = pulse_on;
 	o_redStatus->cur_state = off;
+	tft.resume();
+	serial_queue_release();
 }
 
 const struct state *
@@ -771,15 +796,15 @@ not reached
 	}
 #endif
 
-	t = loop_start_t - full_time;
+	t = loop_start_us - full_time;
 
-	if (t >= main_ig_n2o_close && ig_n2o_on) {
+	if (t >= US(main_ig_n2o_close) && ig_n2o_on) {
 		o_n2oIgValve->cur_state = off;
 		ig_n2o_on = false;
-		event(IgN2OClose, 0);
+		event_snap(IgN2OClose, 0);
 	}
 
-	if (t >= main_run_time)
+	if (t >= US(main_run_time))
 		return &sequenceReport;
 
 	return current_state;
@@ -797,7 +822,7 @@ void
 sequenceReportEnter()
 {
 	pulse_state = 0;
-	seq_rep_next_time = loop_start_t + SEQ_REP_PULSE_WIDTH;
+	seq_rep_next_time = loop_start_us + US(SEQ_REP_PULSE_WIDTH);
 	o_greenStatus->cur_state = off;
 	o_amberStatus->cur_state = on;
 	o_redStatus->cur_state = off;
@@ -822,20 +847,20 @@ const struct state *
 sequenceReportCheck()
 {
 	if (pulse_state == 0) {
-		if (loop_start_t >= seq_rep_next_time) {
+		if (TIME_REACHED(loop_start_us, seq_rep_next_time)) {
 			pulse_state = 1;
 			o_daq0->cur_state = off;
 			o_daq1->cur_state = off;
-			seq_rep_next_time = loop_start_t + SEQ_REP_PULSE_WIDTH;
+			seq_rep_next_time = loop_start_us + US(SEQ_REP_PULSE_WIDTH);
 		}
 		return current_state;
 	} else if (pulse_state == 1)  {
-		if (loop_start_t >= seq_rep_next_time)
+		if (TIME_REACHED(loop_start_us, seq_rep_next_time))
 			pulse_state = 2;
 		return current_state;
 	}
 
-	event_commit_conditional();
+	event_commit_conditional(0);
 
 	return tft_menu_machine(&main_menu);
 }
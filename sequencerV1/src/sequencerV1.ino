@@ -18,7 +18,12 @@
  *
  *  Note that this routine does not interleave TFT display features
  *    in the control loop.  This sequencer does not keep
- *    a running display as it works.
+ *    a running display as it works.  What drawing there is
+ *    is queued and sent between control ticks (see tft_queue.h).
+ *
+ *  The control step runs once per control tick (see controltick.h).
+ *    The serial console runs on every pass through loop(), between ticks.
+ *    Its output is queued and sent as the port takes it (see serial_queue.h).
  *
  */
 
@@ -52,6 +57,18 @@
 #include "state_machine.h"
 #include "tft_menu.h"
 #include "joystick.h"
+#include "looptime.h"
+#include "controltick.h"
+#include "tft_queue.h"
+#include "adc_sampler.h"
+#include "pin_capture.h"
+#include "spark.h"
+#include "ram.h"
+#include "serial_queue.h"
+#include "telemetry.h"
+#include "eeprom_queue.h"
+#include "events.h"
+#include "sd_log.h"
 
 const char * const build_str = "V0.2: 160801";
 
@@ -63,9 +80,10 @@ const char * const build_str = "V0.2: 160801";
 
 /*
  * TFT Display Control
+ * Draw through tft, which queues.  tft_hw is the display itself.
  */
-Adafruit_ST7735 tft = Adafruit_ST7735(TFT_CS, TFT_DC, TFT_RST);
-//Adafruit_ST7735 tft = Adafruit_ST7735(TFT_CS, TFT_DC, TFT_MOSI, TFT_SCLK, TFT_RST);	// use software SPI
+Adafruit_ST7735 tft_hw = Adafruit_ST7735(TFT_CS, TFT_DC, TFT_RST);
+//Adafruit_ST7735 tft_hw = Adafruit_ST7735(TFT_CS, TFT_DC, TFT_MOSI, TFT_SCLK, TFT_RST);	// use software SPI
 
 #include "eepromlocal.h"
 
@@ -89,8 +107,8 @@ extern struct state igLongTestEntry;
 extern struct state flowTest;
 extern struct state sequenceEntry;
 extern struct state eventsToSerial;
-#ifdef TRACE
 extern struct state traceToSerial;
+#ifdef TRACE_TEST
 extern struct state traceTest;
 #endif
 extern struct state powerTest;
@@ -104,7 +122,7 @@ const char m_msg_dump_events[]     PROGMEM = "Dump Events";
 #ifdef notdef	// trace now accessed from debug command
 const char m_msg_dump_trace[]      PROGMEM = "Dump Trace";
 #endif
-#ifdef TRACE
+#ifdef TRACE_TEST
 const char m_msg_trace_test[]      PROGMEM = "Trace Test";
 #endif
 const char m_msg_ig_local_debug[]  PROGMEM = "Ig Local Debug";
@@ -140,7 +158,7 @@ const struct menu_item main_menu_items[] = {
      &traceToSerial,
   },
 #endif
-#ifdef TRACE
+#ifdef TRACE_TEST
   {
      m_msg_trace_test,
      &traceTest,
@@ -214,7 +232,7 @@ const struct state *check_startup()
  * This routine handles capturing the joystick only on the edge.
  *
  * The variable joystick_edge_value contains the value of the joystick
- * for exactly one iteration of loop().  After that it reverts to
+ * for exactly one control step.  After that it reverts to
  * JOY_NONE until the next time something happens to the joystick.
  *
  * If a state's check routine decides on a new state because of the joystick
@@ -241,23 +259,22 @@ static void joystick_edge_trigger()
 void setup() {
   void mainValveInit();
   void event_init();
-#ifdef TRACE
-  void trace_init();
-#endif
   void myPanic(const char *msg);
 
-  Serial.begin(9600);
-  Serial.print("Build ");
-  Serial.println(build_str);
+  ram_paint();
+  Serial.begin(SQ_BAUD);
+  console.print("Build ");
+  console.println(build_str);
 
-  Serial.println("Startup.");
+  console.println("Startup.");
   setup_inputs();
+  adc_sampler_start();
+  pin_capture_start();
   setup_outputs();
   event_init();
-#ifdef TRACE
   trace_init();
-#endif
   digitalWrite(o_powerStatus->pin, HIGH);
+  output_forget(o_powerStatus);
   if (!validate_io())
     myPanic("Invalid I/O Setup");
   if (eeprom_check_and_init())
@@ -270,10 +287,13 @@ void setup() {
   o_amberStatus->cur_state = on;
   o_redStatus->cur_state = off;
 
+  // the SD card shares SPI with the display; start it first (see sd_card.h)
+  sdl_init();
+
   // initialize the 1.8" TFT screen
-  tft.initR(INITR_BLACKTAB);  // initialize a ST7735S chip, black tab
+  tft_hw.initR(INITR_BLACKTAB);  // initialize a ST7735S chip, black tab
+  tft_hw.setRotation(3);  // rotate output to match installed screen orientation
   tft.fillScreen(ST7735_BLACK);
-  tft.setRotation(3);  // rotate output to match installed screen orientation
 
   // note: if using black background, looks OK to start at position 0,0
   tft.setCursor(0, 0);  // note: sets cursor to pixel position, not line number
@@ -281,25 +301,49 @@ void setup() {
   tft.setTextWrap(false);
 
   // Do this last before we kick off the loop.
-  Serial.println("For help, type \"?\".");
-  Serial.print("Inputs: ");
-  Serial.println(n_inputs);
-  Serial.print("Outputs: ");
-  Serial.println(n_outputs);
+  console.println("For help, type \"?\".");
+  console.print("Inputs: ");
+  console.println(n_inputs);
+  console.print("Outputs: ");
+  console.println(n_outputs);
   read_inputs();
+  control_tick_start();
 }
 
 void loop() {
-  loop_start_t = millis();
+  // basic state machine steps, once per tick
+  if (control_tick()) {
+    looptime_start();
+    read_inputs();
+    trace_step();
+    looptime_phase(lt_inputs);
+    joystick_edge_trigger();
+    looptime_phase(lt_joystick);
+    check_state();
+    spark_step();
+    looptime_phase(lt_check);
+    update_outputs();
+    telemetry_step();
+    looptime_phase(lt_outputs);
+  }
 
+  // background work, every pass
   handle_serial();
+  serial_queue_run();
+  looptime_phase(lt_serial);
   handle_cmd();
-
-  // basic state machine steps
-  read_inputs();
-  joystick_edge_trigger();
-  check_state();
-  update_outputs();
-
+  help_run();
+  looptime_phase(lt_cmd);
+  tft_queue_run();
+  looptime_phase(lt_tft);
+  eeq_run();
+  looptime_phase(lt_eeq);
+  sdl_run();
+  looptime_phase(lt_sd);
+  looptime_to_serial();
+  event_dump_run();
+  trace_run();
+  looptime_phase(lt_dump);
+  looptime_end();
 }
-
+
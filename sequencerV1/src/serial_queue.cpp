@@ -0,0 +1,157 @@
+/*
+ * Queued serial output.  See serial_queue.h
+ *
+ * A priority may only fill the ring down to sq_reserve[] free bytes.
+ * Once a character is dropped, the rest of its line is dropped too, so
+ * what does get out is whole lines, not pieces run together.
+ */
+
+#include <Arduino.h>
+#include "serial_queue.h"
+
+SerialQueue console(sq_normal);
+SerialQueue console_bulk(sq_bulk);
+SerialQueue console_urgent(sq_urgent);
+
+static const unsigned char sq_reserve[sq_n_prios] = {
+	SQ_SIZE / 2,	// bulk
+	SQ_LINE / 2,	// normal
+	0,		// urgent
+};
+
+static unsigned char sq_buf[SQ_SIZE];
+static unsigned char sq_head;		// next byte to write
+static unsigned char sq_tail;		// next byte to send
+static bool sq_held;
+static bool sq_dropping[sq_n_prios];	// dropping to the end of the line
+
+/*
+ * Statistics
+ */
+static unsigned char sq_max;		// most bytes queued
+static unsigned long sq_dropped;	// bytes
+static unsigned long sq_drop_lines;	// lines cut short
+
+static inline unsigned char sq_used()
+{
+	return (unsigned char)(sq_head - sq_tail);
+}
+
+static inline unsigned char sq_free()
+{
+	return (unsigned char)(sq_tail - sq_head - 1);
+}
+
+/*
+ * Make room for one byte at priority p.  While not held, that means
+ * sending the oldest byte, which waits if the serial port is busy.
+ */
+static bool sq_room(unsigned char p)
+{
+	while (sq_free() == 0) {
+		if (sq_held)
+			return false;
+		Serial.write(sq_buf[sq_tail++]);
+	}
+	return !sq_held || sq_free() > sq_reserve[p];
+}
+
+size_t SerialQueue::write(uint8_t c)
+{
+	if (sq_dropping[prio] || !sq_room(prio)) {
+		if (!sq_dropping[prio])
+			sq_drop_lines++;
+		sq_dropping[prio] = (c != '\n');
+		sq_dropped++;
+		return 0;
+	}
+	sq_buf[sq_head++] = c;
+	if (sq_used() > sq_max)
+		sq_max = sq_used();
+	return 1;
+}
+
+int SerialQueue::availableForWrite()
+{
+	unsigned char f = sq_free();
+
+	return (f > sq_reserve[prio])? f - sq_reserve[prio]: 0;
+}
+
+void serial_queue_hold()
+{
+	sq_held = true;
+}
+
+void serial_queue_release()
+{
+	sq_held = false;
+}
+
+/*
+ * Send everything now, waiting on the serial port.  For myPanic().
+ */
+void serial_queue_flush()
+{
+	while (sq_tail != sq_head)
+		Serial.write(sq_buf[sq_tail++]);
+}
+
+/*
+ * True when the ring is empty and the serial port has sent all but the
+ * character it may be shifting out.
+ */
+bool serial_queue_idle()
+{
+	return sq_tail == sq_head && Serial.availableForWrite() >= SERIAL_TX_BUFFER_SIZE - 1;
+}
+
+/*
+ * Change the baud rate.  Serial.flush() waits out the last character.
+ */
+void serial_queue_baud(unsigned long baud)
+{
+	Serial.flush();
+	Serial.begin(baud);
+}
+
+/*
+ * Called from loop() on every pass.
+ */
+void serial_queue_run()
+{
+	unsigned long start = micros();
+	int n;
+
+	while (sq_tail != sq_head) {
+		n = Serial.availableForWrite();
+		if (n <= 0)
+			return;
+		if (n > sq_used())
+			n = sq_used();
+		while (n-- > 0)
+			Serial.write(sq_buf[sq_tail++]);
+		if (micros() - start >= SQ_SLICE_US)
+			return;
+	}
+}
+
+void serial_queue_reset()
+{
+	sq_max = sq_used();
+	sq_dropped = 0;
+	sq_drop_lines = 0;
+}
+
+void serial_queue_dump()
+{
+	console.print(F("TX queue "));
+	console.print(SQ_SIZE);
+	console.print(F(" bytes, most used "));
+	console.print(sq_max);
+	console.print(F(", dropped "));
+	console.print(sq_dropped);
+	console.print(F(" bytes in "));
+	console.print(sq_drop_lines);
+	console.println(F(" lines"));
+}
@@ -1,16 +1,21 @@
 /*
- *  This code handles the spark test
+ *  This code handles the spark test, and the spark generator (see spark.h)
  */
 
+#include <Arduino.h>
+#include <stdlib.h>
 #include "parameters.h"
 #include "state_machine.h"
+#include "spark.h"
+#include "events.h"
+#include "serial_queue.h"
 #include "joystick.h"
 #include "tft_menu.h"
 #include "io_ref.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 void sparkTestEnter();
@@ -18,8 +23,6 @@ void sparkTestExit();
 const struct state *sparkTestCheck();
 struct state sparkTest = { "sparkTest", &sparkTestEnter, &sparkTestExit, &sparkTestCheck};
 
-unsigned long spark_bias;
-
 // local state of buttons.  Used to optimize display
 static unsigned char ls1;	// edge triggered
 static unsigned char els1;
@@ -113,7 +116,6 @@ void sparkTestEnter()
 	sparkButtonDisplay();
 	o_ipaIgValve->cur_state = off;
 	o_n2oIgValve->cur_state = off;
-	spark_bias = 0;
 }
 
 /*
@@ -124,9 +126,195 @@ void sparkTestExit()
 	o_spark->cur_state = off;
 }
 
+/*
+ * The generator.  The control step writes sp_want and, while it is
+ * stopped, the period; the rest is the interrupt's.  sp_want is the
+ * ticks the spark may still run without another spark_step() asking:
+ * a period, so a control step that stops for longer than that, or
+ * never comes back, stops the spark.
+ */
+#define	SPARK_TICKS(ms)	((unsigned long)(ms) * 1000 / CONTROL_TICK_US)
+
+static bool sp_asked;			// spark_run() this step
+static volatile unsigned int sp_want;	// ticks, 0: stop
+static volatile enum { sp_idle, sp_running, sp_draining } sp_state;
+static unsigned char sp_level;
+static unsigned int sp_phase;		// ticks into the period
+static unsigned int sp_period = SPARK_TICKS(spark_period);
+static unsigned int sp_high = SPARK_TICKS(spark_high);
+static volatile unsigned long sp_on_us;	// first rising edge of the latest run
+static volatile unsigned long sp_off_us;	// latest falling edge
+static volatile unsigned int sp_sparks;	// rising edges in the latest run
+static volatile unsigned char sp_starts;	// runs, mod 256
+static volatile unsigned char sp_stops;
+static unsigned char sp_starts_seen;	// as of the last spark_step()
+static unsigned char sp_stops_seen;
+
+/*
+ * Have the pin go to level l at the compare match in this tick.
+ */
+static inline void spark_pin(unsigned char l)
+{
+#ifdef __AVR__
+	TCCR2A = _BV(WGM21) | _BV(COM2B1) | (l? _BV(COM2B0): 0);
+#else
+	digitalWrite(o_spark->pin, l);
+#endif
+}
+
+/*
+ * Give the pin back to its PORT bit.
+ */
+static inline void spark_release()
+{
+#ifdef __AVR__
+	TCCR2A = _BV(WGM21);
+#endif
+}
+
+/*
+ * Called from the control tick interrupt, with the time of the tick.
+ */
+void spark_tick(unsigned long tick_us)
+{
+	unsigned char l;
+	bool want = sp_want != 0;
+
+	if (want)
+		sp_want--;
+	if (sp_state == sp_draining) {
+		spark_release();
+		sp_state = sp_idle;
+		sp_stops++;
+	}
+	if (sp_state == sp_idle) {
+		if (!want)
+			return;
+		sp_state = sp_running;
+		sp_phase = 0;
+		sp_sparks = 0;
+	}
+	if (want) {
+		l = sp_phase < sp_high;
+		if (++sp_phase >= sp_period)
+			sp_phase = 0;
+	} else {
+		l = LOW;
+		sp_state = sp_draining;
+	}
+	spark_pin(l);
+	if (l == sp_level)
+		return;
+	sp_level = l;
+#ifdef __AVR__
+	tick_us += SPARK_EDGE_US;
+#endif
+	if (!l) {
+		sp_off_us = tick_us;
+	} else if (sp_sparks++ == 0) {
+		sp_on_us = tick_us;
+		sp_starts++;
+	}
+}
+
+/*
+ * Called by a state on each control step it wants the spark.
+ */
 void spark_run()
 {
-	o_spark->cur_state = ((loop_start_t - spark_bias) % spark_period < spark_period/2)? on: off;
+	sp_asked = true;
+}
+
+/*
+ * For myPanic(): stop the generator and drive the pin low now, with
+ * nothing left to start it again.  The control tick stops with it.
+ */
+void spark_stop()
+{
+	noInterrupts();
+#ifdef __AVR__
+	TIMSK2 = 0;
+	TCCR2A = _BV(WGM21);
+#endif
+	sp_want = 0;
+	sp_state = sp_idle;
+	interrupts();
+	digitalWrite(SPARK_PIN, LOW);
+}
+
+bool spark_running()
+{
+	return sp_state != sp_idle;
+}
+
+static unsigned int spark_ago(unsigned long us)
+{
+	us = loop_start_us - us;
+	return (us > 0xffff)? 0xffff: us;
+}
+
+/*
+ * Called from loop() after check_state().  Starts or stops the
+ * generator, and logs the edges the interrupt has timed since the last
+ * step.  A start is logged once its edge has happened.
+ */
+void spark_step()
+{
+	unsigned char starts, stops;
+	unsigned long on_us, off_us;
+
+	noInterrupts();
+	sp_want = sp_asked? sp_period: 0;
+	starts = sp_starts;
+	stops = sp_stops;
+	on_us = sp_on_us;
+	off_us = sp_off_us;
+	interrupts();
+	sp_asked = false;
+
+	if (starts != sp_starts_seen && TIME_REACHED(loop_start_us, on_us)) {
+		sp_starts_seen = starts;
+		event(SparkOn, spark_ago(on_us));
+	}
+	if (stops != sp_stops_seen && starts == sp_starts_seen) {
+		sp_stops_seen = stops;
+		event(SparkOff, spark_ago(off_us));
+		output_forget(o_spark);		// the pin is the PORT bit again
+	}
+}
+
+void spark_cmd(const char *period, const char *high)
+{
+	unsigned long p, h;
+
+	if (period != NULL) {
+		p = SPARK_TICKS(atoi(period));
+		h = (high == NULL)? p / 2: SPARK_TICKS(atoi(high));
+		if (spark_running()) {
+			console.println(F("Spark is running, try again."));
+			return;
+		} else if (p < 2 || p > SPARK_TICKS(SPARK_MS_MAX) || h < 1 || h >= p) {
+			console.println(F("Need a period of 2 to 250 ms and a high time shorter than that."));
+			return;
+		}
+		noInterrupts();
+		sp_period = p;
+		sp_high = h;
+		interrupts();
+	}
+	console.print(F("Spark: period "));
+	console.print((unsigned long)sp_period * CONTROL_TICK_US / 1000);
+	console.print(F(" ms, high "));
+	console.print((unsigned long)sp_high * CONTROL_TICK_US / 1000);
+	console.print(F(" ms, "));
+	console.println(spark_running()? F("running"): F("stopped"));
+	if (sp_sparks == 0 || spark_running())
+		return;
+	console.print(F("Last run: "));
+	console.print(sp_sparks);
+	console.print(F(" sparks in "));
+	console.print(sp_off_us - sp_on_us);
+	console.println(F(" us, first rising to last falling edge"));
 }
 
 /*
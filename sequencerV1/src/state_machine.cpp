@@ -1,31 +1,59 @@
 #include "state_machine.h"
 #include <Arduino.h>
 #include <string.h>
+#include <stdlib.h>
 #include "trace.h"
+#include "looptime.h"
+#include "controltick.h"
+#include "adc_sampler.h"
+#include "pin_capture.h"
+#include "spark.h"
+#include "io_ref.h"
+#include "serial_queue.h"
+#include "telemetry.h"
+#include "eeprom_queue.h"
+#include "events.h"
+#include "sd_log.h"
+#include "sd_card.h"
+#include "ram.h"
 
 #define INPUT_BUF_SZ 64
+#define SERIAL_BUDGET_US 200	// most time handle_serial() spends per loop
 char input_buf[INPUT_BUF_SZ];
 int input_idx = 0;
 boolean input_discard = false;
 boolean cmd_valid = false;
 const boolean verbose = true;
 
-const unsigned long debounce_t = 25;
-
 char* cmd_str = NULL;
 char* id_str = NULL;
 char* val_str = NULL;
 const char* separator = " \t\r\n";
 
-const char* help_str =
+static const char help_str[] PROGMEM =
 "Valid commands:\n"
 "  set_i <input name> <input mode>: set the input to a mode\n"
 "  set_om <output name> <output mode>: set the output to a mode\n"
 "  set_ov <output name> <output value>: set the output value\n"
 "  read <input name>: query the current mode and value of an input\n"
 "  reada <input name>: read the analog value of an input\n"
+"  filter [bench | <input> bypass | m | <k> | m<k>]: show, time or set analog input filters\n"
+"  sample [<input> <ticks>]: show what reading each input costs, or read it every <ticks> ticks,\n"
+"    with its debounce rescaled to the same time\n"
 "  read <output name>: query the current mode and value of an output\n"
-"  tracedump: dump the current signal trace\n"
+"  outputs [bench]: show the output pins and their last levels, or time writing them\n"
+"  trace [period <ticks> | post <n> | event <code> | env <ticks>]: show or set the trace recorder\n"
+"  tracedump: dump the trace in EEPROM, samples and envelope\n"
+"  looptime [reset]: show or clear per-state loop timing\n"
+"  ram: show static, heap and stack RAM use\n"
+"  eeq: show progress of background EEPROM writes\n"
+"  tick [reset]: show or clear control tick lateness\n"
+"  txq [reset]: show or clear serial output queue use and drops\n"
+"  telem [off | <ms>]: show, stop or start binary telemetry every <ms>\n"
+"  runs [<n>]: list the event logs in EEPROM, or print log n\n"
+"  runbin [<n> [<baud>]]: send log n as binary frames, at <baud> if given\n"
+"  sd [open | close]: show the SD card, or open or close a run file\n"
+"  spark [<period> [<high>]]: show the spark generator, or set its period and high time in ms\n"
 "  state: query the current state of the state machine\n"
 "  list_io: list the available inputs and outputs\n"
 "  list_modes: list available input / output modes\n";
@@ -58,9 +86,9 @@ const char* output_state_str[N_OUTPUT_STATES] = {
 	"single_on",
 	"single_off",
 	"pulse_on",
-	"pulse_off"
+	"pulse_off",
 	"pwm",
-	"servo_congtrolled",
+	"servo_controlled",
 };
 
 
@@ -69,7 +97,9 @@ const struct state startup = {"startup", NULL,          NULL,         &check_sta
 const struct state * current_state = &startup;
 
 unsigned long loop_start_t = 0; //time this loop iteration started. Used as "now" for things that care.
+unsigned long loop_start_us = 0; //same, in microseconds.  Wraps every 71 minutes.
 unsigned long state_enter_t = 0;
+unsigned long state_enter_us = 0;
 unsigned long state_end_t = 0;
 
 int find_str(const char* s, const char** a, const int n) {
@@ -80,31 +110,395 @@ int find_str(const char* s, const char** a, const int n) {
   return -1;
 }
 
+/*
+ * Console commands.
+ *
+ * Each command is a handler plus its name, in a PROGMEM table sorted by
+ * name, found by binary search.  validate_io() checks the order, so a
+ * new command has to go in its place alphabetically (strcmp order: '_'
+ * sorts before the letters).
+ *
+ * Handlers see the tokens in cmd_str, id_str and val_str, and the input
+ * and/or output named by id_str, if any.
+ */
+typedef void (*cmd_fn)(struct input *in, struct output *out);
+
+struct cmd {
+  const char *name;	// in PROGMEM
+  cmd_fn fn;
+};
+
+/*
+ * help_str is about 1.7 KB, well over a second at 9600 baud and more
+ * than the ring holds, so printing it in one go waited on the serial
+ * port, whatever the state.  It goes out through console_bulk a line
+ * at a time from help_run(), as the dumps do.
+ */
+static const char* help_at;	// next line of help_str, NULL when done
+
+static void cmd_help(struct input *in, struct output *out) {
+  console.println(F("State machine console interface help."));
+  console.print(F("Build: "));
+  console.println(build_str);
+  help_at = help_str;
+}
+
+/*
+ * Called from loop() on every pass.
+ */
+void help_run() {
+  const char* e;
+  char c;
+
+  if (help_at == NULL) return;
+  for (e = help_at; (c = pgm_read_byte(e)) != '\0' && c != '\n'; e++)
+    ;
+  if (console_bulk.availableForWrite() <= e - help_at) return;
+  while (help_at < e) console_bulk.write(pgm_read_byte(help_at++));
+  console_bulk.write('\n');
+  help_at = (c == '\0' || pgm_read_byte(e + 1) == '\0')? NULL: e + 1;
+}
+
+static void cmd_read(struct input *in, struct output *out) {
+  if (in != NULL) {
+    console.print(F("Normal: "));
+    console.println(input_mode_str[in->normal]);
+    console.print(F("Current: "));
+    console.println(input_mode_str[in->current]);
+    console.print(F("Val: "));
+    if (in->current_val < N_INPUT_STATES)
+      console.println(input_state_str[in->current_val]);
+    else
+      console.println(in->current_val);	// multi_input
+    if (in->analog_th >= 0) {
+      console.print(F("Filtered: "));
+      console.println(in->filter_a);
+    }
+    console.print(F("Edges: "));
+    console.print(in->edges);
+    console.print(F(", newest "));
+    console.print(edge_age(edge_last(in)));
+    console.print(F(" ms ago, "));
+    console.print(edge_overruns);
+    console.println(F(" skipped by slow readers"));
+  }
+  if (out != NULL) {
+    console.print(F("Output mode normal: "));
+    console.println(output_mode_str[out->normal]);
+    console.print(F("Output mode current: "));
+    console.println(output_mode_str[out->current]);
+    console.print(F("Value: "));
+    console.println(output_state_str[out->cur_state]);
+  }
+}
+
+static void cmd_reada(struct input *in, struct output *out) {
+  if (in != NULL) {
+    int a = adc_sample(in->pin, NULL);
+    if (a < 0) {
+      console.println(F("Not an analog input."));
+    } else {
+      console.print(a);
+      if (adc_ovs(in->pin)) {
+        console.print(F(" / "));
+        console.print(1 << adc_ovs(in->pin));
+      }
+      console.println();
+    }
+  }
+}
+
+static void cmd_set_i(struct input *in, struct output *out) {
+  if (val_str == NULL) {
+    console.println("No value to set.");
+  } else if (in == NULL) {
+    console.println("No input specified.");
+  } else {
+    int v = find_str(val_str, input_mode_str, N_INPUT_MODES);
+    if (v == -1) {
+      console.println("Value not valid.");
+    } else {
+      in->current = (input_mode)v;
+    }
+  }
+}
+
+static void cmd_set_om(struct input *in, struct output *out) {
+  if (val_str == NULL) {
+    console.println("No value to set.");
+  } else if (out == NULL) {
+    console.println("No output specified.");
+  } else {
+    int v = find_str(val_str, output_mode_str, N_OUTPUT_MODES);
+    if (v == -1) {
+      console.println("Value not valid.");
+    } else {
+      out->current = (output_mode)v;
+    }
+  }
+}
+
+static void cmd_set_ov(struct input *in, struct output *out) {
+  if (val_str == NULL) {
+    console.println("No value to set.");
+  } else if (out == NULL) {
+    console.println("No output specified.");
+  } else {
+    int v = find_str(val_str, output_state_str, N_OUTPUT_STATES);
+    if (v == -1) {
+      console.println("Value not valid.");
+    } else {
+      out->cur_state = (output_state)v;
+    }
+  }
+}
+
+static void cmd_trace(struct input *in, struct output *out) {
+  trace_cmd(id_str, val_str);
+}
+
+static void cmd_tracedump(struct input *in, struct output *out) {
+  if (!eeq_idle()) {
+    console.println(F("EEPROM busy, try again."));
+  } else {
+    trace_dump();
+  }
+}
+
+static void cmd_filter(struct input *in, struct output *out) {
+  filter_cmd(in, id_str, val_str);
+}
+
+static void cmd_sample(struct input *in, struct output *out) {
+  sample_cmd(in, val_str);
+}
+
+static void cmd_outputs(struct input *in, struct output *out) {
+  outputs_cmd(id_str);
+}
+
+static void cmd_ram(struct input *in, struct output *out) {
+  ram_dump();
+}
+
+static void cmd_looptime(struct input *in, struct output *out) {
+#ifndef LOOPTIME
+  console.println(F("Loop timing is not built in, see looptime.h."));
+#else
+  if (id_str != NULL && strcmp(id_str, "reset") == 0) {
+    looptime_reset();
+    console.println(F("Loop times cleared."));
+  } else {
+    looptime_dump();
+  }
+#endif
+}
+
+static void cmd_tick(struct input *in, struct output *out) {
+  if (id_str != NULL && strcmp(id_str, "reset") == 0) {
+    control_tick_reset();
+    console.println(F("Tick statistics cleared."));
+  } else {
+    control_tick_dump();
+  }
+}
+
+static void cmd_txq(struct input *in, struct output *out) {
+  if (id_str != NULL && strcmp(id_str, "reset") == 0) {
+    serial_queue_reset();
+    console.println(F("TX queue statistics cleared."));
+  } else {
+    serial_queue_dump();
+  }
+}
+
+static void cmd_runs(struct input *in, struct output *out) {
+  if (!eeq_idle()) {
+    console.println(F("EEPROM busy, try again."));
+  } else if (id_str == NULL) {
+    event_list_runs();
+  } else {
+    event_dump(atoi(id_str));
+  }
+}
+
+static void cmd_runbin(struct input *in, struct output *out) {
+  if (!eeq_idle()) {
+    console.println(F("EEPROM busy, try again."));
+  } else {
+    event_dump_bin((id_str == NULL)? EVENT_NEWEST: atoi(id_str),
+                   (val_str == NULL)? 0: atol(val_str));
+  }
+}
+
+static void cmd_sd(struct input *in, struct output *out) {
+  sdl_cmd(id_str);
+}
+
+static void cmd_spark(struct input *in, struct output *out) {
+  spark_cmd(id_str, val_str);
+}
+
+static void cmd_state(struct input *in, struct output *out) {
+  console.print(F("Current state: "));
+  console.println(current_state->name);
+}
+
+static void cmd_eeq(struct input *in, struct output *out) {
+  eeq_dump();
+}
+
+static void cmd_telem(struct input *in, struct output *out) {
+  telemetry_cmd(id_str);
+}
+
+static void cmd_list_io(struct input *in, struct output *out) {
+  console.println("\nAvailable inputs:");
+  for (int i = 0; i < n_inputs; i++) console.println(inputs[i].name);
+  console.println("\nAvailable outputs:");
+  for (int i = 0; i < n_outputs; i++) console.println(outputs[i].name);
+}
+
+static void cmd_list_modes(struct input *in, struct output *out) {
+  console.println("\nAvailable input modes:");
+  for (int i = 0; i < N_INPUT_MODES; i++) console.println(input_mode_str[i]);
+  console.println("\nAvailable output modes:");
+  for (int i = 0; i < N_OUTPUT_MODES; i++) console.println(output_mode_str[i]);
+  console.println("\nAvailable output states:");
+  for (int i = 0; i < N_OUTPUT_STATES; i++) console.println(output_state_str[i]);
+}
+
+static const char c_eeq[] PROGMEM = "eeq";
+static const char c_filter[] PROGMEM = "filter";
+static const char c_list_io[] PROGMEM = "list_io";
+static const char c_list_modes[] PROGMEM = "list_modes";
+static const char c_looptime[] PROGMEM = "looptime";
+static const char c_outputs[] PROGMEM = "outputs";
+static const char c_ram[] PROGMEM = "ram";
+static const char c_read[] PROGMEM = "read";
+static const char c_reada[] PROGMEM = "reada";
+static const char c_runbin[] PROGMEM = "runbin";
+static const char c_runs[] PROGMEM = "runs";
+static const char c_sample[] PROGMEM = "sample";
+static const char c_sd[] PROGMEM = "sd";
+static const char c_set_i[] PROGMEM = "set_i";
+static const char c_set_om[] PROGMEM = "set_om";
+static const char c_set_ov[] PROGMEM = "set_ov";
+static const char c_spark[] PROGMEM = "spark";
+static const char c_state[] PROGMEM = "state";
+static const char c_telem[] PROGMEM = "telem";
+static const char c_tick[] PROGMEM = "tick";
+static const char c_trace[] PROGMEM = "trace";
+static const char c_tracedump[] PROGMEM = "tracedump";
+static const char c_txq[] PROGMEM = "txq";
+
+// sorted by name
+static const struct cmd cmds[] PROGMEM = {
+  { c_eeq,		&cmd_eeq },
+  { c_filter,		&cmd_filter },
+  { c_list_io,		&cmd_list_io },
+  { c_list_modes,	&cmd_list_modes },
+  { c_looptime,		&cmd_looptime },
+  { c_outputs,		&cmd_outputs },
+  { c_ram,		&cmd_ram },
+  { c_read,		&cmd_read },
+  { c_reada,		&cmd_reada },
+  { c_runbin,		&cmd_runbin },
+  { c_runs,		&cmd_runs },
+  { c_sample,		&cmd_sample },
+  { c_sd,		&cmd_sd },
+  { c_set_i,		&cmd_set_i },
+  { c_set_om,		&cmd_set_om },
+  { c_set_ov,		&cmd_set_ov },
+  { c_spark,		&cmd_spark },
+  { c_state,		&cmd_state },
+  { c_telem,		&cmd_telem },
+  { c_tick,		&cmd_tick },
+  { c_trace,		&cmd_trace },
+  { c_tracedump,	&cmd_tracedump },
+  { c_txq,		&cmd_txq },
+};
+#define N_CMDS (sizeof (cmds) / sizeof (cmds[0]))
+
+static cmd_fn find_cmd(const char *s) {
+  int lo = 0, hi = N_CMDS - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int c = strcmp_P(s, (const char *)pgm_read_word(&cmds[mid].name));
+    if (c == 0) return (cmd_fn)pgm_read_word(&cmds[mid].fn);
+    if (c < 0) hi = mid - 1;
+    else lo = mid + 1;
+  }
+  return NULL;
+}
+
+/*
+ * I/O names, sorted.  An entry below n_inputs is that input, otherwise
+ * it is output (entry - n_inputs).  Built by validate_io().
+ */
+#define IO_INDEX_MAX 32
+static unsigned char io_index[IO_INDEX_MAX];
+static unsigned char n_io_index;
+
+static const char *io_name(unsigned char k) {
+  return (k < n_inputs)? inputs[k].name: outputs[k - n_inputs].name;
+}
+
+static int find_io(const char *s) {
+  int lo = 0, hi = n_io_index - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int c = strcmp(s, io_name(io_index[mid]));
+    if (c == 0) return io_index[mid];
+    if (c < 0) hi = mid - 1;
+    else lo = mid + 1;
+  }
+  return -1;
+}
+
+/*
+ * Sort the I/O names, and check they and the command table are in order
+ * with no duplicates.
+ */
+static boolean build_io_index() {
+  unsigned char i, j, k;
+
+  if (n_inputs + n_outputs > IO_INDEX_MAX) return false;
+  n_io_index = 0;
+  for (i = 0; i < n_inputs + n_outputs; i++) {
+    // insertion sort; there are only a few
+    for (j = n_io_index; j > 0 && strcmp(io_name(i), io_name(io_index[j - 1])) < 0; j--)
+      io_index[j] = io_index[j - 1];
+    io_index[j] = i;
+    n_io_index++;
+  }
+  for (k = 1; k < n_io_index; k++)
+    if (strcmp(io_name(io_index[k - 1]), io_name(io_index[k])) == 0) return false;
+
+  for (k = 1; k < N_CMDS; k++) {
+    char prev[16];	// longer than any command name
+    strncpy_P(prev, (const char *)pgm_read_word(&cmds[k - 1].name), sizeof (prev) - 1);
+    prev[sizeof (prev) - 1] = 0;
+    if (strcmp_P(prev, (const char *)pgm_read_word(&cmds[k].name)) >= 0) return false;
+  }
+  return true;
+}
+
 void handle_cmd() {
   if (!cmd_valid) return;
   if (input_discard) return;
   if (verbose) {
-    Serial.print(F("Command: '"));
-    Serial.print(input_buf);
-    Serial.println("'");
+    console.print(F("Command: '"));
+    console.print(input_buf);
+    console.println("'");
   }
 
   cmd_str = strtok(input_buf, separator);
   id_str = strtok(NULL, separator);
   val_str = strtok(NULL, separator);  
   
-  if (false && verbose) {
-    Serial.print(F("Command: '"));
-    Serial.print((cmd_str != NULL) ? cmd_str : "NULL");
-    Serial.print(F("'\nId:      '"));
-    Serial.print((id_str != NULL) ? id_str : "NULL");
-    Serial.print(F("'\nVal:     '"));
-    Serial.print((val_str != NULL) ? val_str : "NULL");
-    Serial.print(F("'\n"));
-  }
-  
   if (cmd_str == NULL) {
-    Serial.println("No command found. Type \"?\" for additional help.");
+    console.println("No command found. Type \"?\" for additional help.");
     input_idx = 0;
     cmd_valid = false;
     cmd_str = NULL;
@@ -116,117 +510,17 @@ void handle_cmd() {
   input* in = NULL;
   output* out = NULL;
   
-  for (int i = 0; i < n_inputs; i++) {
-    if (strcmp(inputs[i].name, id_str) == 0) {
-      in = &inputs[i];
-      break;
-    }
+  if (id_str != NULL) {
+    int k = find_io(id_str);
+    if (k >= n_inputs) out = &outputs[k - n_inputs];
+    else if (k >= 0) in = &inputs[k];
   }
   
-  for (int i = 0; i < n_outputs; i++) {
-    if (strcmp(outputs[i].name, id_str) == 0) {
-      out = &outputs[i];
-      break;
-    }
-  }
-  
-  if (false && verbose) {
-    if (in != NULL) Serial.println("Matching input found.");
-    if (out != NULL) Serial.println("Matching output found.");
-  }
-  
-  if (strncmp(cmd_str, "?", 1) == 0) {
-    Serial.println(F("State machine console interface help."));
-    Serial.print(F("Build: "));
-    Serial.println(build_str);
-    Serial.println(help_str);
-  } else if (strcmp(cmd_str, "read") == 0) {
-    if (in != NULL) {
-      Serial.print(F("Normal: "));
-      Serial.println(input_mode_str[in->normal]);
-      Serial.print(F("Current: "));
-      Serial.println(input_mode_str[in->current]);
-      Serial.print(F("Val: "));
-      Serial.println(input_state_str[in->current_val]);
-      if (in->analog_th >= 0) {
-        Serial.print(F("Filtered: "));
-        Serial.println(in->filter_a);
-      }
-    }
-    if (out != NULL) {
-      Serial.print(F("Output mode normal: "));
-      Serial.println(output_mode_str[out->normal]);
-      Serial.print(F("Output mode current: "));
-      Serial.println(output_mode_str[out->current]);
-      Serial.print(F("Value: "));
-      Serial.println(output_state_str[out->cur_state]);
-    }
-  } else if (strcmp(cmd_str, "reada") == 0) {
-    if (in != NULL) {
-      int a = analogRead(in->pin);
-      Serial.println(a);
-    }
-  } else if (strcmp(cmd_str, "set_i") == 0) {
-    if (val_str == NULL) {
-      Serial.println("No value to set.");
-    } else if (in == NULL) {
-      Serial.println("No input specified.");
-    } else {
-      int v = find_str(val_str, input_mode_str, N_INPUT_MODES);
-      if (v == -1) {
-        Serial.println("Value not valid.");
-      } else {
-        in->current = (input_mode)v;
-      }
-    }
-  } else if (strcmp(cmd_str, "set_om") == 0) {
-    if (val_str == NULL) {
-      Serial.println("No value to set.");
-    } else if (out == NULL) {
-      Serial.println("No output specified.");
-    } else {
-      int v = find_str(val_str, output_mode_str, N_OUTPUT_MODES);
-      if (v == -1) {
-        Serial.println("Value not valid.");
-      } else {
-        out->current = (output_mode)v;
-      }      
-    }
-  } else if (strcmp(cmd_str, "set_ov") == 0) {
-    if (val_str == NULL) {
-      Serial.println("No value to set.");
-    } else if (out == NULL) {
-      Serial.println("No output specified.");
-    } else {
-      int v = find_str(val_str, output_state_str, N_OUTPUT_STATES);
-      if (v == -1) {
-        Serial.println("Value not valid.");
-      } else {
-        out->cur_state = (output_state)v;
-      }      
-    }
- #ifdef TRACE
-  } else if (strcmp(cmd_str, "tracedump") == 0) {
-    for (int i = 0; !trace_to_serial(i); i++) ;
-    Serial.println("Done printing trace");
- #endif
-  } else if (strcmp(cmd_str, "state") == 0) {
-    Serial.print(F("Current state: "));
-    Serial.println(current_state->name);
-  } else if (strcmp(cmd_str, "list_io") == 0) {
-    Serial.println("\nAvailable inputs:");
-    for (int i = 0; i < n_inputs; i++) Serial.println(inputs[i].name);
-    Serial.println("\nAvailable outputs:");
-    for (int i = 0; i < n_outputs; i++) Serial.println(outputs[i].name);
-  } else if (strcmp(cmd_str, "list_modes") == 0) {
-    Serial.println("\nAvailable input modes:");
-    for (int i = 0; i < N_INPUT_MODES; i++) Serial.println(input_mode_str[i]);
-    Serial.println("\nAvailable output modes:");
-    for (int i = 0; i < N_OUTPUT_MODES; i++) Serial.println(output_mode_str[i]);
-    Serial.println("\nAvailable output states:");
-    for (int i = 0; i < N_OUTPUT_STATES; i++) Serial.println(output_state_str[i]);
+  cmd_fn fn = (cmd_str[0] == '?')? &cmd_help: find_cmd(cmd_str);
+  if (fn != NULL) {
+    (*fn)(in, out);
   } else {
-    Serial.println("No valid command found. Type \"?\" for help.");
+    console.println("No valid command found. Type \"?\" for help.");
   }
   
   input_idx = 0;
@@ -236,7 +530,8 @@ void handle_cmd() {
   val_str = NULL;
 }
 
-//Handle a single character from the serial port. Don't process a bunch at once, for latency / simplicity reasons.
+//Take in what the serial port has, up to SERIAL_BUDGET_US of work per loop, stopping
+//early at the end of a command so it can be handled before more is read.
 //Precondition: the beginning of the buffer holds less than a complete command.
 //This means: No '\n' or '\0' characters at indexes < input_idx.
 //Postcondition: if there is a complete command in the buffer, cmd_valid will be set
@@ -245,39 +540,46 @@ void handle_cmd() {
 //will work well.
 //Implications: after calling, handle the command if applicable.
 //Also: the command handling routine should reset input_idx to 0 when done.
+//A line too long for the buffer is reported and dropped up to its newline.
 void handle_serial() {
-  if (!Serial.available()) return;
-  if (input_idx >= INPUT_BUF_SZ) return;
-  
-  int in = Serial.read();
-  if (in == -1) return;
-  
-  if (in == '\n') {
-    if (input_discard) {
-      input_idx = 0;
-      input_discard = false;
+  unsigned long start = micros();
+
+  while (!cmd_valid && Serial.available() > 0) {
+    int in = Serial.read();
+    if (in == -1) return;
+
+    if (in == '\n') {
+      if (input_discard) {
+        input_idx = 0;
+        input_discard = false;
+        continue;
+      }
+      input_buf[input_idx] = 0;
+      cmd_valid = true;
+      return;
     }
-    input_buf[input_idx] = 0;
-    cmd_valid = true;
-    return;
-  }
-  if (input_idx >= INPUT_BUF_SZ + 1) {
-    //too long, no newline: discard
-    Serial.println("Too much input, discarding.");
-    input_discard = true;
-    return;
+    if (input_discard) continue;
+    if (input_idx >= INPUT_BUF_SZ - 1) {
+      //too long, no newline: discard
+      console.println("Too much input, discarding.");
+      input_discard = true;
+      continue;
+    }
+    input_buf[input_idx] = in;
+    input_idx++;
+    if (micros() - start >= SERIAL_BUDGET_US) return;
   }
-  input_buf[input_idx] = in;
-  input_idx++;
 }
 
 
-//TODO: check that names and pins are unique
+//Checks that pins are unique.  build_io_index() checks names.
 boolean validate_io() {
   unsigned char ipin1;
   unsigned char ipin2;
   const unsigned char analog_pin = 0x80;	// bit to mark a pin as analog
 
+  if (!build_io_index()) return false;
+
   for (int i = 0; i < n_inputs; i++) {
     ipin1 = inputs[i].pin;
     if (inputs[i].analog_th >= 0) {
@@ -294,6 +596,9 @@ boolean validate_io() {
       return false;
     }
     if (inputs[i].analog_hyst < 0) return false;
+    if (inputs[i].sample_ticks < 1 || inputs[i].sample_ticks > SAMPLE_TICKS_MAX) return false;
+    if (inputs[i].debounce < 1) return false;
+    if (inputs[i].capture && inputs[i].analog_th != -1) return false;
     for (int j = i + 1; j < n_inputs; j++) {
       ipin2 = inputs[j].pin;
       if (inputs[j].analog_th >= 0)
@@ -304,26 +609,74 @@ boolean validate_io() {
       if (ipin1 == outputs[j].pin) return false;
     }
   }
+  int n_captured = 0;
+  for (int i = 0; i < n_inputs; i++) {
+    if (inputs[i].pin == SD_CS) return false;
+    if (inputs[i].capture) n_captured++;
+  }
+  if (n_captured > CAPTURE_MAX) return false;	// one would go unwatched
   for (int i = 0; i < n_outputs; i++) {
+    if (outputs[i].pin == SD_CS) return false;	// sd_init() drives it
     for (int j = i + 1; j < n_outputs; j++) {
       if (outputs[i].pin == outputs[j].pin) return false;
     }
   }
+  if (o_spark->pin != SPARK_PIN) return false;	// the generator needs OC2B
   return true;
 }
 
+/*
+ * Read the inputs that are due this control step (see state_machine.h).
+ */
 void read_inputs() {
   for (int i = 0; i < n_inputs; i++) {
-    read_input(&inputs[i]);
+    struct input* in = &inputs[i];
+    if (in->sample_wait > 0) {
+      in->sample_wait--;
+      continue;
+    }
+    in->sample_wait = in->sample_ticks - 1;
+    read_input(in);
   }
 }
 
+/*
+ * One output a step is written whatever its level says (see
+ * state_machine.h), so a pin written behind update_output()'s back is
+ * put right within n_outputs steps.  Not the spark while the generator
+ * has it.
+ */
+static unsigned char out_refresh;
+
 void update_outputs() {
+  struct output* r = &outputs[out_refresh];
+  if (r != o_spark || !spark_running()) output_forget(r);
+  if (++out_refresh >= n_outputs) out_refresh = 0;
   for (int i = 0; i < n_outputs; i++) {
     update_output(&outputs[i]);
   }
 }
 
+/*
+ * Bit i set if outputs[i] is commanded on, for the first 16 outputs.
+ */
+unsigned int output_bitmap() {
+  unsigned int bits = 0;
+
+  for (int i = 0; i < n_outputs && i < 16; i++) {
+    switch (outputs[i].cur_state) {
+      case on:
+      case single_on:
+      case pulse_on:
+        bits |= 1U << i;
+        break;
+      default:
+        break;
+    }
+  }
+  return bits;
+}
+
 void check_state() {
   void myPanic(const char *msg);
   if (current_state->check != NULL) {
@@ -331,16 +684,17 @@ void check_state() {
     if (new_state == NULL) myPanic("null state");
     if (new_state != current_state) {
       if (verbose) {
-        Serial.print(F("Leaving "));
-        Serial.print(current_state->name);
+        console.print(F("Leaving "));
+        console.print(current_state->name);
       }
       state_end_t = loop_start_t;
       if (current_state->exit != NULL) (*(current_state->exit))();
       current_state = new_state;
       state_enter_t = state_end_t;
+      state_enter_us = loop_start_us;
       if (verbose) {
-        Serial.print(F("; Entering "));
-        Serial.println(new_state->name);
+        console.print(F("; Entering "));
+        console.println(new_state->name);
       }
       if (current_state->enter != NULL) (*(current_state->enter))();
     }
@@ -350,6 +704,7 @@ void check_state() {
 void setup_inputs() {
   for (int i = 0; i < n_inputs; i++) {
     input_setup(&inputs[i]);
+    inputs[i].sample_wait = i % inputs[i].sample_ticks;	// stagger the slow ones
   }
 }
 
@@ -359,8 +714,207 @@ void setup_outputs() {
   }
 }
 
+/*
+ * Run an analog sample through the input's filter (see state_machine.h).
+ * Returns the result in ADC counts; filter_a keeps it
+ * ANALOG_FILTER_SCALE times larger.  Shifts only: the divide by
+ * ANALOG_FILTER_TIME this replaced cost a 32 bit division per input per
+ * tick.
+ */
+static unsigned int analog_filter(struct input* in, unsigned int v) {
+  unsigned char k = in->filter & FILT_IIR_MASK;
+
+  if (in->filter & FILT_MEDIAN3) {
+    unsigned int a = in->filter_hist[0], b = in->filter_hist[1];
+    in->filter_hist[1] = a;
+    in->filter_hist[0] = v;
+    if (a > b) { unsigned int t = a; a = b; b = t; }
+    if (v < a) v = a;
+    else if (v > b) v = b;
+  }
+  v <<= ANALOG_FILTER_SHIFT - FILT_OVS_BITS(in->filter);
+  if (k == 0) {
+    in->filter_a = v;
+  } else {
+    // difference is within +-4096; >> of a negative int is arithmetic in gcc
+    in->filter_a += ((int)v - (int)in->filter_a + (1 << (k - 1))) >> k;
+  }
+  return in->filter_a >> ANALOG_FILTER_SHIFT;
+}
+
+/*
+ * The filter analog_filter() replaced, for filter_bench().
+ */
+static unsigned int __attribute__((noinline)) old_filter(struct input* in, unsigned int v) {
+  unsigned long f = in->filter_a;
+  f *= (8 - 1UL);
+  f += v * ANALOG_FILTER_SCALE + ANALOG_FILTER_SCALE/2;
+  f /= 8;
+  in->filter_a = f;
+  return f / ANALOG_FILTER_SCALE;
+}
+
+static void print_filter(unsigned char filter) {
+  if ((filter & (FILT_MEDIAN3 | FILT_IIR_MASK)) == FILT_BYPASS) console.print(F("bypass"));
+  if (filter & FILT_MEDIAN3) console.print(F("median"));
+  if ((filter & FILT_MEDIAN3) && (filter & FILT_IIR_MASK)) console.print(F(", "));
+  if (filter & FILT_IIR_MASK) {
+    console.print(F("iir "));
+    console.print(filter & FILT_IIR_MASK);
+  }
+}
+
+/*
+ * Time each kind of filter, and the one it replaced, on
+ * FILTER_BENCH_N samples.  The loop is included.  On the host micros()
+ * does not move, so this only means something on the Mega.
+ */
+#define FILTER_BENCH_N 1000
+static void filter_bench() {
+  static const unsigned char kinds[] = {
+    FILT_BYPASS, FILT_MEDIAN3, FILT_IIR(3), FILT_MEDIAN3 | FILT_IIR(3),
+  };
+  struct input t = inputs[0];	// scratch
+  volatile unsigned int sink;	// so the filtering is not optimised away
+  unsigned long start, us;
+  unsigned int i, k;
+
+  console.println(F("Filter ns per sample:"));
+  for (k = 0; k <= sizeof (kinds); k++) {
+    t.filter = (k < sizeof (kinds))? kinds[k]: FILT_IIR(3);
+    start = micros();
+    if (k < sizeof (kinds)) {
+      for (i = 0; i < FILTER_BENCH_N; i++) analog_filter(&t, (i * 37) & 0x3ff);
+    } else {
+      for (i = 0; i < FILTER_BENCH_N; i++) old_filter(&t, (i * 37) & 0x3ff);
+    }
+    sink = t.filter_a;
+    us = micros() - start;
+    console.print(F("  "));
+    if (k < sizeof (kinds)) print_filter(t.filter);
+    else console.print(F("old divide, time 8"));
+    console.print(F(": "));
+    console.println(us * (1000 / FILTER_BENCH_N));
+  }
+  (void)sink;
+}
+
+/*
+ * filter: list the analog inputs' filters.  filter bench: time them.
+ * filter <input> <spec>: set one, spec bypass, m (median), <k> (iir k)
+ * or m<k> (both).
+ */
+void filter_cmd(struct input* in, const char* what, const char* spec) {
+  unsigned char f;
+  int k;
+
+  if (what != NULL && strcmp(what, "bench") == 0) {
+    filter_bench();
+    return;
+  }
+  if (what == NULL) {
+    for (int i = 0; i < n_inputs; i++) {
+      if (inputs[i].analog_th < 0) continue;
+      console.print(inputs[i].name);
+      console.print(F(": "));
+      print_filter(inputs[i].filter);
+      if (adc_ovs(inputs[i].pin)) {
+        console.print(F(", oversampled "));
+        console.print(adc_ovs(inputs[i].pin));
+        console.print(F(" bits"));
+      }
+      console.print(F(", sample delay "));
+      console.print(adc_delay_us(inputs[i].pin));
+      console.println(F(" us"));
+    }
+    return;
+  }
+  if (in == NULL || in->analog_th < 0 || spec == NULL) {
+    console.println(F("Need an analog input and a filter."));
+    return;
+  }
+  f = FILT_BYPASS;
+  if (strcmp(spec, "bypass") != 0) {
+    if (*spec == 'm') {
+      if (FILT_OVS_BITS(in->filter)) {
+        console.println(F("No median on an oversampled input."));
+        return;
+      }
+      f |= FILT_MEDIAN3;
+      spec++;
+    }
+    k = atoi(spec);
+    if (k < 0 || k > FILT_IIR_MAX || (f == FILT_BYPASS && k == 0)) {
+      console.print(F("IIR shift must be 1 to "));
+      console.println(FILT_IIR_MAX);
+      return;
+    }
+    f |= FILT_IIR(k);
+  }
+  in->filter = f | (in->filter & FILT_OVS(3));
+}
+
+/*
+ * Time one read_input() of each input, on a copy so the input itself is
+ * not disturbed, and add up what read_inputs() costs per control step
+ * as scheduled and as it would be reading every input every step.  As
+ * with filter_bench(), only meaningful on the Mega.  The copy of a
+ * captured input reads its pin directly: pin_capture_read() would take
+ * the changes the input itself has not seen yet.
+ *
+ * Setting an input's period keeps its debounce time: debounce counts
+ * samples, so it is scaled by the old period over the new, rounding up.
+ */
+#define SAMPLE_BENCH_N 100
+void sample_cmd(struct input* in, const char* spec) {
+  unsigned long start, ns, per_tick = 0, every_tick = 0;
+  unsigned char k;
+
+  if (in != NULL) {
+    int n = (spec == NULL)? 0: atoi(spec);
+    if (n < 1 || n > SAMPLE_TICKS_MAX) {
+      console.print(F("Ticks must be 1 to "));
+      console.println(SAMPLE_TICKS_MAX);
+      return;
+    }
+    int d = (in->debounce * in->sample_ticks + n - 1) / n;	// no shorter than it was
+    in->debounce = (d < 1)? 1: (d > 255)? 255: d;
+    in->debounce_n = 0;
+    in->sample_ticks = n;
+    in->sample_wait = 0;
+    console.print(in->name);
+    console.print(F(": debounce "));
+    console.print(in->debounce);
+    console.println(F(" samples"));
+    return;
+  }
+  console.println(F("Input, read every N ticks, ns per read:"));
+  for (int i = 0; i < n_inputs; i++) {
+    struct input t = inputs[i];
+    t.capture = 0;
+    start = micros();
+    for (k = 0; k < SAMPLE_BENCH_N; k++) read_input(&t);
+    ns = (micros() - start) * (1000 / SAMPLE_BENCH_N);
+    per_tick += ns / inputs[i].sample_ticks;
+    every_tick += ns;
+    console.print(F("  "));
+    console.print(inputs[i].name);
+    console.print(F(": "));
+    console.print(inputs[i].sample_ticks);
+    console.print(F(", "));
+    console.println(ns);
+  }
+  console.print(F("read_inputs ns per tick: "));
+  console.print(per_tick);
+  console.print(F(", "));
+  console.print(every_tick);
+  console.println(F(" reading every input every tick"));
+}
+
 void read_input(struct input* in) {
   unsigned char in_val = false;
+  bool changed = false;		// the pin changed since the last sample, captured inputs
+  unsigned long t_us;
   input_mode m = in->current;
   if (m == def_in) m = in->normal;
   
@@ -370,20 +924,11 @@ void read_input(struct input* in) {
     in_val = false;
   } else {
     if (in->analog_th == -1) {
-      in_val = digitalRead(in->pin);
+      if (in->capture) changed = pin_capture_read(in->pin, &in_val, &t_us);
+      else in_val = digitalRead(in->pin);
       if (m == active_low_in || m == active_low_pullup) in_val = !in_val;
     } else {
-      int v = analogRead(in->pin);
-      unsigned long f = in->filter_a;
-      f *= (ANALOG_FILTER_TIME - 1UL);
-      f += v * ANALOG_FILTER_SCALE + ANALOG_FILTER_SCALE/2;
-      f /= ANALOG_FILTER_TIME;
-      in->filter_a = f;
-#ifdef TRACE_PIN
-      if (in->pin == TRACE_PIN)
-	 trace_point((int)f);
-#endif // TRACE_PIN
-      f /= ANALOG_FILTER_SCALE;
+      unsigned int f = analog_filter(in, adc_sample(in->pin, NULL));
       if (m == active_low_in) {
         if (in->prev_val) {
           in_val = (f < in->analog_th);
@@ -400,7 +945,7 @@ void read_input(struct input* in) {
         const unsigned int *ladder = multi_input_ladders[in->multi_input_ladder];
 	unsigned int l = ladder[0];
 	for (in_val = 1; in_val <= l; in_val++)
-	  if (v < ladder[in_val])
+	  if (f < ladder[in_val])
 	    goto found;
 	in_val = 0;	// off the top of the ladder, return 0.
 	found:;
@@ -420,44 +965,171 @@ void read_input(struct input* in) {
    * state changes on transition to those regions.  This code assumes
    * you have a joystick, not a sensor.
    *
-   * Note 2: in this block we use millis() rather than loop_start_t
-   * because it may have been some time since loop_start_t before
-   * this routine is called.  The pins are sampled in this routine,
-   * so using millis() is more accurate.
+   * Note 2: the wait is counted in samples (see state_machine.h).
+   * read_inputs() runs once per control step, so a sample is
+   * sample_ticks ticks after the one before, whatever the step cost.
+   *
+   * Note 3: a captured input also starts over if the pin changed and
+   * came back between samples, and its edge gets the time the pin
+   * changed rather than the time of the sample.
    */
-  if (in_val != in->prev_val) {
+  if (in_val != in->prev_val || changed) {
+    unsigned int t = loop_start_t;
+    if (changed) t += (long)(t_us - loop_start_us) / 1000;
     in->prev_val = in_val;
-    in->last_change_t = millis();
-  } else {
-    if (in->last_change_t + debounce_t < millis() &&
-      in->current_val != in_val) {
-        in->edge = (in_val? rising: falling);
-        in->current_val = in_val;
+    in->debounce_n = 0;
+    in->edge_q[in->edges % EDGE_Q] = t & EDGE_T_MASK;	// not an edge yet
+  } else if (in->current_val != in_val && ++in->debounce_n >= in->debounce) {
+    if (in_val) in->edge_q[in->edges % EDGE_Q] |= EDGE_RISING;
+    in->edges++;
+    in->current_val = in_val;
+  }
+}
+
+/*
+ * Edge readers, see state_machine.h.
+ */
+unsigned int edge_overruns;
+
+void edge_skip(const struct input* in, unsigned char* cur) {
+  *cur = in->edges;
+}
+
+enum input_edge edge_next(const struct input* in, unsigned char* cur, unsigned int* t) {
+  unsigned char n = in->edges - *cur;
+  unsigned int e;
+
+  if (n == 0) return no_edge;
+  if (n > EDGE_Q - 1) {
+    edge_overruns += n - (EDGE_Q - 1);
+    *cur = in->edges - (EDGE_Q - 1);
+  }
+  e = in->edge_q[*cur % EDGE_Q];
+  (*cur)++;
+  if (t != NULL) *t = e & EDGE_T_MASK;
+  return (e & EDGE_RISING)? rising: falling;
+}
+
+bool edge_rose(const struct input* in, unsigned char* cur, unsigned int* t) {
+  enum input_edge e;
+  unsigned int et;
+  bool rose = false;
+
+  while ((e = edge_next(in, cur, &et)) != no_edge) {
+    if (e == rising && !rose) {
+      rose = true;
+      if (t != NULL) *t = et;
     }
   }
+  return rose;
+}
+
+unsigned int edge_last(const struct input* in) {
+  return in->edge_q[(unsigned char)(in->edges - 1) % EDGE_Q] & EDGE_T_MASK;
+}
+
+unsigned int edge_age(unsigned int t) {
+  return ((unsigned int)loop_start_t - t) & EDGE_T_MASK;
 }
 
 
 void output_setup(struct output* out) {
+#ifdef __AVR__
+  out->port = portOutputRegister(digitalPinToPort(out->pin));
+  out->mask = digitalPinToBitMask(out->pin);
+#endif
+  out->level = OUT_LEVEL_NONE;
   update_output(out);
   pinMode(out->pin, OUTPUT);
 }
 
+void output_forget(struct output* out) {
+  out->level = OUT_LEVEL_NONE;
+}
+
+/*
+ * Set an output pin, if it is not already.  Interrupts are off for the
+ * read-modify-write: the Servo interrupt writes pins on PORTE and PORTH
+ * too, and those are out of reach of the single instruction sbi/cbi.
+ */
+static void output_write(struct output* out, unsigned char level) {
+  level = level? HIGH: LOW;
+  if (level == out->level) return;
+  out->level = level;
+#ifdef __AVR__
+  uint8_t sreg = SREG;
+  cli();
+  if (level) *out->port |= out->mask;
+  else *out->port &= ~out->mask;
+  SREG = sreg;
+#else
+  digitalWrite(out->pin, level);
+#endif
+}
+
+/*
+ * Time update_outputs() as it runs, with nothing to write; writing every
+ * output through the port registers; and the digitalWrite() for every
+ * output it used to make.  The same levels are written again, so the
+ * pins do not move.  On the host micros() does not move.
+ */
+#define OUTPUT_BENCH_N 100
+void outputs_cmd(const char* what) {
+  unsigned long start, us[3];
+  unsigned char k, i;
+
+  if (what == NULL || strcmp(what, "bench") != 0) {
+    for (i = 0; i < n_outputs; i++) {
+      console.print(outputs[i].name);
+      console.print(F(": pin "));
+      console.print(outputs[i].pin);
+      console.print(F(", mask 0x"));
+      console.print(outputs[i].mask, HEX);
+      console.print(F(", level "));
+      console.println(outputs[i].level);
+    }
+    return;
+  }
+  for (k = 0; k < 3; k++) {
+    start = micros();
+    for (i = 0; i < OUTPUT_BENCH_N; i++) {
+      if (k == 0) {
+        update_outputs();
+      } else if (k == 1) {
+        for (int j = 0; j < n_outputs; j++) output_forget(&outputs[j]);
+        update_outputs();
+      } else {
+        // digitalWrite() would take OC2B off a running spark
+        for (int j = 0; j < n_outputs; j++)
+          if (&outputs[j] != o_spark) digitalWrite(outputs[j].pin, outputs[j].level);
+      }
+    }
+    us[k] = micros() - start;
+  }
+  console.println(F("CPU cycles per update_outputs():"));
+  console.print(F("  unchanged: "));
+  console.println(us[0] * (F_CPU / 1000000) / OUTPUT_BENCH_N);
+  console.print(F("  all written: "));
+  console.println(us[1] * (F_CPU / 1000000) / OUTPUT_BENCH_N);
+  console.print(F("  digitalWrite() of each, as before: "));
+  console.println(us[2] * (F_CPU / 1000000) / OUTPUT_BENCH_N);
+}
+
 void update_output(output* out) {
   output_mode m = out->current;
   if (m == def_out) m = out->normal;
   if (m == force_low) {
-    digitalWrite(out->pin, LOW);
+    output_write(out, LOW);
     return;
   } else if (m == force_high) {
-    digitalWrite(out->pin, HIGH);
+    output_write(out, HIGH);
     return;
   } else {
   }
   switch (out->cur_state) {
     case on:
     case off:
-      digitalWrite(out->pin, (m != active_low_out) != (out->cur_state != on)); // All the != operators force casts to booleans
+      output_write(out, (m != active_low_out) != (out->cur_state != on)); // All the != operators force casts to booleans
       break;
     case single_on:
     case single_off:
@@ -466,25 +1138,25 @@ void update_output(output* out) {
       }
       if (out->last_change_t + out->p.pulse_t < loop_start_t) {
         out->cur_state = (out->cur_state == single_on) ? off : on;
-        digitalWrite(out->pin, (m != active_low_out) == (out->cur_state != on));
+        output_write(out, (m != active_low_out) == (out->cur_state != on));
         out->last_change_t = 0;
       } else {
-        digitalWrite(out->pin, (m != active_low_out) == (out->cur_state != single_on));
+        output_write(out, (m != active_low_out) == (out->cur_state != single_on));
       }
       break;
     case pulse_on:
     case pulse_off:
       if (out->last_change_t + out->p.pulse_t < loop_start_t) {
         out->cur_state = (out->cur_state == pulse_on) ? pulse_off : pulse_on;
-        digitalWrite(out->pin, (m != active_low_out) == (out->cur_state != pulse_on));
+        output_write(out, (m != active_low_out) == (out->cur_state != pulse_on));
         out->last_change_t = loop_start_t;
       } else {
-        digitalWrite(out->pin, (m != active_low_out) == (out->cur_state != pulse_on));
+        output_write(out, (m != active_low_out) == (out->cur_state != pulse_on));
       }
       break;
     case pwm:
       //not yet supported
-      digitalWrite(out->pin, LOW);
+      output_write(out, LOW);
       break;
   }
 }
@@ -492,6 +1164,7 @@ void update_output(output* out) {
 void input_setup(struct input* in) {
   input_mode m = in->current;
   if (m == def_in) m = in->normal;
+  if (in->analog_th >= 0) adc_sampler_add(in->pin, FILT_OVS_BITS(in->filter));
   switch (m) {
     case active_low_pullup:
     case active_high_pullup:
@@ -501,5 +1174,8 @@ void input_setup(struct input* in) {
       pinMode(in->pin, INPUT);
       break;
   }
+  // No room is caught by validate_io(): capture stays set, and the pin
+  // is just read by pin_capture_read() until then.
+  if (in->capture) pin_capture_add(in->pin);
 }
 
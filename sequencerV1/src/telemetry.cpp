@@ -0,0 +1,215 @@
+/*
+ * Binary telemetry.  See telemetry.h
+ */
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+#include "state_machine.h"
+#include "io_ref.h"
+#include "serial_queue.h"
+#include "telemetry.h"
+#include "crc16.h"
+#include "sd_log.h"
+
+#define	TM_N_STATES	16
+#define	TM_NAME_MAX	24		// longer state names are cut
+#define	TM_OWN_MAX	(3 + TM_NAME_MAX + 2)	// our frames: the state frame
+
+static_assert(TM_OWN_MAX <= TM_BODY_MAX, "state frame too long");
+
+static unsigned int tm_period;		// ms, 0 when off
+static bool tm_held;			// nothing to the serial port
+static unsigned long tm_next_us;
+static unsigned char tm_seq;
+static const struct state *tm_states[TM_N_STATES];
+static const struct state *tm_named;	// state of the last state frame
+static const struct state *tm_sd_named;	// and of the last one in the SD file
+static unsigned int tm_sd_file;		// that file
+
+static unsigned long tm_sent;
+static unsigned long tm_skipped;
+
+static unsigned char tm_body[TM_OWN_MAX];
+static unsigned char tm_len;
+
+static inline void tm_put(unsigned char b)
+{
+	tm_body[tm_len++] = b;
+}
+
+static void tm_put16(unsigned int v)
+{
+	tm_put(v & 0xff);
+	tm_put(v >> 8);
+}
+
+/*
+ * Add the CRC to a frame body of len bytes and COBS encode it into
+ * wire.  The body has room for the CRC after len, up to TM_BODY_MAX
+ * bytes in all.  Returns the length on the wire.
+ */
+unsigned char telemetry_encode(unsigned char *body, unsigned char len, unsigned char *wire)
+{
+	unsigned int crc;
+	unsigned char n, code_at, i;
+
+	crc = crc16(CRC16_INIT, body, len);
+	body[len++] = crc & 0xff;
+	body[len++] = crc >> 8;
+
+	n = 0;
+	wire[n++] = 0;
+	code_at = n++;
+	for (i = 0; i < len; i++) {
+		if (body[i] == 0) {
+			wire[code_at] = n - code_at;
+			code_at = n++;
+		} else {
+			wire[n++] = body[i];
+			if (n - code_at == 0xff) {
+				wire[code_at] = 0xff;
+				code_at = n++;
+			}
+		}
+	}
+	wire[code_at] = n - code_at;
+	wire[n++] = 0;
+	return n;
+}
+
+/*
+ * Frame a body as telemetry_encode() does and queue it, if it fits.
+ */
+bool telemetry_frame(unsigned char *body, unsigned char len)
+{
+	unsigned char wire[TM_WIRE_MAX];
+	unsigned char n;
+
+	n = telemetry_encode(body, len, wire);
+	if (console_bulk.availableForWrite() < n)
+		return false;
+	console_bulk.write(wire, n);
+	return true;
+}
+
+static inline bool tm_send()
+{
+	return !tm_held && telemetry_frame(tm_body, tm_len);
+}
+
+void telemetry_hold()
+{
+	tm_held = true;
+}
+
+void telemetry_release()
+{
+	tm_held = false;
+}
+
+static unsigned char tm_state_id(const struct state *s)
+{
+	unsigned char i;
+
+	for (i = 0; i < TM_N_STATES && tm_states[i]; i++)
+		if (tm_states[i] == s)
+			return i;
+	if (i == TM_N_STATES)
+		return 0xff;
+	tm_states[i] = s;
+	return i;
+}
+
+/*
+ * Called at the end of each control step.
+ */
+void telemetry_step()
+{
+	const char *name;
+	unsigned char id, k;
+	unsigned int sd;
+	bool sd_name;
+
+	if (tm_period == 0 || !TIME_REACHED(loop_start_us, tm_next_us))
+		return;
+	tm_next_us += (unsigned long)tm_period * 1000UL;
+	if (TIME_REACHED(loop_start_us, tm_next_us))
+		tm_next_us = loop_start_us + (unsigned long)tm_period * 1000UL;	// fell behind
+
+	id = tm_state_id(current_state);
+	sd = sdl_file();
+	sd_name = sd && (sd != tm_sd_file || current_state != tm_sd_named);
+	if (current_state != tm_named || sd_name) {
+		name = current_state->name;
+		tm_len = 0;
+		tm_put(TM_STATE);
+		tm_put(tm_seq);
+		tm_put(id);
+		for (k = 0; name[k] && k < TM_NAME_MAX; k++)
+			tm_put(name[k]);
+		if (current_state != tm_named && tm_send())
+			tm_named = current_state;
+		if (sd_name && sdl_frame(tm_body, tm_len)) {
+			tm_sd_named = current_state;
+			tm_sd_file = sd;
+		}
+	}
+
+	tm_len = 0;
+	tm_put(TM_SAMPLE);
+	tm_put(tm_seq++);
+	tm_put16(loop_start_us & 0xffff);
+	tm_put16(loop_start_us >> 16);
+	tm_put(id);
+	tm_put16(output_bitmap());
+	tm_put16(i_ig_pressure->filter_a);
+	tm_put16(i_main_press->filter_a);
+	tm_put16(i_power_sense->filter_a);
+	if (tm_send())
+		tm_sent++;
+	else
+		tm_skipped++;
+	if (sd)
+		sdl_frame(tm_body, tm_len);
+}
+
+void telemetry_cmd(const char *arg)
+{
+	unsigned int ms;
+
+	if (arg == NULL) {
+		console.print(F("Telemetry "));
+		if (tm_period) {
+			console.print(F("every "));
+			console.print(tm_period);
+			console.print(F(" ms"));
+		} else
+			console.print(F("off"));
+		if (tm_held)
+			console.print(F(", held"));
+		console.print(F(", "));
+		console.print(tm_sent);
+		console.print(F(" samples sent, "));
+		console.print(tm_skipped);
+		console.println(F(" skipped"));
+		return;
+	}
+	if (strcmp(arg, "off") == 0) {
+		tm_period = 0;
+		return;
+	}
+	ms = atoi(arg);
+	if (ms < TELEM_MIN_MS) {
+		console.print(F("Period must be at least "));
+		console.print(TELEM_MIN_MS);
+		console.println(F(" ms."));
+		return;
+	}
+	tm_period = ms;
+	tm_next_us = loop_start_us;
+	tm_named = NULL;
+	tm_sd_named = NULL;
+	tm_sent = 0;
+	tm_skipped = 0;
+}
@@ -10,6 +10,8 @@
 #include "io_ref.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
+#include "serial_queue.h"
 
 /*
  * Menu state
@@ -64,7 +66,6 @@ static void screen_paint()
 	int y;
 	unsigned char n_items = current_menu->n_items;
 	int txt_color;
-	extern Adafruit_ST7735 tft;
 
 	start_row = 0;
 	if (n_items > TM_N_ROWS && TM_N_ROWS/2 < menu_state) {
@@ -91,8 +92,6 @@ static void screen_paint()
 
 struct state * tft_menu_machine(const struct menu *my_menu)
 {
-	extern Adafruit_ST7735 tft;
-
 	/*
 	 * Commenting out this line should result in the menu system
 	 * returning to previous state.  Needs testing.
@@ -120,7 +119,7 @@ const struct state * check_j_idle()
 	v = i_joystick->current_val;
 
 	if (v == JOY_PRESS) {
-		Serial.println("JSP");
+		console.println("JSP");
 		return current_menu->items[menu_state].action_state;
 	}
 
@@ -0,0 +1,312 @@
+/*
+ * Deferred TFT drawing.  See tft_queue.h
+ *
+ * Commands are kept in a byte ring.  A byte below 0x80 is a character
+ * to print.  Anything else is an opcode, followed by its arguments,
+ * 16 bit ones low byte first.
+ *
+ * Many check routines set the text color and size on every call.
+ * Those are only queued when they change, or they would fill the ring
+ * while a screen erase is going out.
+ */
+
+#include <Arduino.h>
+#include "tft_queue.h"
+#include "sd_card.h"
+
+enum tq_op {
+	TQ_CHAR = 0x80,	// c		character >= 0x80
+	TQ_FILL,	// x y w h color
+	TQ_SCREEN,	// color
+	TQ_CURSOR,	// x y
+	TQ_COLOR,	// c bg
+	TQ_SIZE,	// s
+	TQ_WRAP,	// w
+};
+
+TftQueue tft;
+
+static unsigned char tq_buf[TFTQ_SIZE];
+static unsigned char tq_head;		// next byte to write
+static unsigned char tq_tail;		// next byte to send
+static bool tq_paused;
+
+/*
+ * Text settings as of the last queued command.
+ */
+static uint16_t tq_color, tq_bg;
+static bool tq_color_set;
+static uint8_t tq_size;			// 0 until first set
+static uint8_t tq_wrap = 2;		// neither true nor false
+
+/*
+ * The fill being sent, if any.
+ */
+static struct {
+	int16_t x, y, w, h;
+	uint16_t color;
+	int16_t r, c;			// next row and column to fill
+} fl;
+static bool fl_active;
+
+static inline unsigned char tq_free()
+{
+	return (unsigned char)(tq_tail - tq_head - 1);
+}
+
+static inline unsigned char tq_get()
+{
+	return tq_buf[tq_tail++];
+}
+
+static int16_t tq_get16()
+{
+	unsigned char lo = tq_get();
+
+	return (int16_t)(lo | (unsigned int)tq_get() << 8);
+}
+
+static inline void tq_put(unsigned char b)
+{
+	tq_buf[tq_head++] = b;
+}
+
+static void tq_put16(uint16_t v)
+{
+	tq_put(v & 0xff);
+	tq_put(v >> 8);
+}
+
+static void tq_fill_start(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+	if (w <= 0 || h <= 0)
+		return;
+	fl.x = x;
+	fl.y = y;
+	fl.w = w;
+	fl.h = h;
+	fl.color = color;
+	fl.r = 0;
+	fl.c = 0;
+	fl_active = true;
+}
+
+/*
+ * Send one piece of the current fill: whole rows if they are narrow
+ * enough, else part of a row.
+ */
+static void tq_fill_piece()
+{
+	int16_t n;
+
+	if (fl.c == 0 && fl.w <= TFTQ_FILL_PX) {
+		n = min(TFTQ_FILL_PX / fl.w, fl.h - fl.r);
+		tft_hw.fillRect(fl.x, fl.y + fl.r, fl.w, n, fl.color);
+		fl.r += n;
+	} else {
+		n = min(TFTQ_FILL_PX, fl.w - fl.c);
+		tft_hw.fillRect(fl.x + fl.c, fl.y + fl.r, n, 1, fl.color);
+		fl.c += n;
+		if (fl.c >= fl.w) {
+			fl.c = 0;
+			fl.r++;
+		}
+	}
+	if (fl.r >= fl.h)
+		fl_active = false;
+}
+
+/*
+ * Send one piece: a fill piece, or the next command.
+ */
+static void tq_step()
+{
+	unsigned char op;
+	int16_t x, y, w, h;
+	uint16_t c;
+
+	if (fl_active) {
+		tq_fill_piece();
+		return;
+	}
+	if (tq_tail == tq_head)
+		return;
+
+	op = tq_get();
+	if (op < TQ_CHAR) {
+		tft_hw.write(op);
+		return;
+	}
+	switch (op) {
+	    case TQ_CHAR:
+		tft_hw.write(tq_get());
+		break;
+	    case TQ_FILL:
+		x = tq_get16();
+		y = tq_get16();
+		w = tq_get16();
+		h = tq_get16();
+		c = tq_get16();
+		tq_fill_start(x, y, w, h, c);
+		break;
+	    case TQ_SCREEN:
+		c = tq_get16();
+		tq_fill_start(0, 0, tft_hw.width(), tft_hw.height(), c);
+		break;
+	    case TQ_CURSOR:
+		x = tq_get16();
+		y = tq_get16();
+		tft_hw.setCursor(x, y);
+		break;
+	    case TQ_COLOR:
+		c = tq_get16();
+		tft_hw.setTextColor(c, tq_get16());
+		break;
+	    case TQ_SIZE:
+		tft_hw.setTextSize(tq_get());
+		break;
+	    case TQ_WRAP:
+		tft_hw.setTextWrap(tq_get());
+		break;
+	}
+}
+
+/*
+ * Room for n bytes?  Sending commands to make room could mean finishing
+ * a screen erase, 100 ms, so a command that does not fit is dropped,
+ * paused or not.  The display is wrong until the next fillScreen().
+ */
+static inline bool tq_room(unsigned char n)
+{
+	return tq_free() >= n;
+}
+
+/*
+ * The screen fill covers everything queued before it, so that goes,
+ * with any fill being sent.  The text settings it may have held are
+ * queued again after the fill.  Every screen starts with one of these,
+ * so each gets the whole ring.
+ */
+void TftQueue::fillScreen(uint16_t color)
+{
+	tq_head = tq_tail;
+	fl_active = false;
+	tq_put(TQ_SCREEN);
+	tq_put16(color);
+	if (tq_color_set) {
+		tq_put(TQ_COLOR);
+		tq_put16(tq_color);
+		tq_put16(tq_bg);
+	}
+	if (tq_size) {
+		tq_put(TQ_SIZE);
+		tq_put(tq_size);
+	}
+	if (tq_wrap != 2) {
+		tq_put(TQ_WRAP);
+		tq_put(tq_wrap);
+	}
+}
+
+void TftQueue::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+	if (!tq_room(11))
+		return;
+	tq_put(TQ_FILL);
+	tq_put16(x);
+	tq_put16(y);
+	tq_put16(w);
+	tq_put16(h);
+	tq_put16(color);
+}
+
+void TftQueue::setCursor(int16_t x, int16_t y)
+{
+	if (!tq_room(5))
+		return;
+	tq_put(TQ_CURSOR);
+	tq_put16(x);
+	tq_put16(y);
+}
+
+void TftQueue::setTextColor(uint16_t c, uint16_t bg)
+{
+	if (tq_color_set && c == tq_color && bg == tq_bg)
+		return;
+	if (!tq_room(5))
+		return;
+	tq_color_set = true;
+	tq_color = c;
+	tq_bg = bg;
+	tq_put(TQ_COLOR);
+	tq_put16(c);
+	tq_put16(bg);
+}
+
+void TftQueue::setTextSize(uint8_t s)
+{
+	if (s == tq_size)
+		return;
+	if (!tq_room(2))
+		return;
+	tq_size = s;
+	tq_put(TQ_SIZE);
+	tq_put(s);
+}
+
+void TftQueue::setTextWrap(bool w)
+{
+	if (w == tq_wrap)
+		return;
+	if (!tq_room(2))
+		return;
+	tq_wrap = w;
+	tq_put(TQ_WRAP);
+	tq_put(w);
+}
+
+size_t TftQueue::write(uint8_t c)
+{
+	if (c < TQ_CHAR) {
+		if (!tq_room(1))
+			return 0;
+	} else {
+		if (!tq_room(2))
+			return 0;
+		tq_put(TQ_CHAR);
+	}
+	tq_put(c);
+	return 1;
+}
+
+void TftQueue::pause()
+{
+	tq_paused = true;
+}
+
+void TftQueue::resume()
+{
+	tq_paused = false;
+}
+
+bool TftQueue::idle()
+{
+	return !fl_active && tq_tail == tq_head;
+}
+
+/*
+ * Called from loop() on every pass.
+ */
+void tft_queue_run()
+{
+	unsigned long start;
+
+	if (tq_paused || sd_sending())	// the card has the bus
+		return;
+	start = micros();
+	while (!tft.idle()) {
+		tq_step();
+		if (micros() - start >= TFTQ_SLICE_US)
+			break;
+	}
+}
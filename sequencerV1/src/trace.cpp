@@ -1,10 +1,13 @@
 /*
- * Code to record a trace of a signal.
- * For now this code only works on analog signal pins.
+ * Trace recorder.  See trace.h
  *
- * Trace is logged to memory, and dumped to EEPROM
+ * The rings are recorded in RAM by the control step and written to
+ * EEPROM in the background once frozen.
  */
 
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include "Arduino.h"
 #include "EEPROM.h"
 #include "parameters.h"
@@ -12,115 +15,362 @@
 #include "io_ref.h"
 #include "trace.h"
 #include "eepromlocal.h"
+#include "serial_queue.h"
+#include "eeprom_queue.h"
+#include "controltick.h"
+#include "crc16.h"
+#include "telemetry.h"
+#include "sd_log.h"
+
+#define	TRACE_CRC_BYTES	offsetof(struct trace_hdr, crc)
+#define	TRACE_EEPROM_END	4096
+
+#define	TRACE_ENV_AT	(EEPROM_DATA_TRACE + sizeof (struct trace_hdr) + TRACE_BYTES)
+#define	TRACE_IMAGE	(sizeof (struct trace_hdr) + TRACE_BYTES + TRACE_ENV_BYTES)
+#define	TRACE_SD_CHUNK	48	// trace bytes per TM_TRACE frame
+
+static_assert(TRACE_SAMPLES <= 255 && (TRACE_SAMPLES * TRACE_CHANNELS) % 2 == 0,
+	"ring must be a whole number of value pairs, indexed by unsigned char");
+static_assert(TRACE_ENV_BUCKETS <= 255 && (TRACE_ENV_BUCKETS * TRACE_CHANNELS) % 2 == 0,
+	"envelope must be a whole number of value pairs, indexed by unsigned char");
+static_assert(TRACE_ENV_AT + TRACE_ENV_BYTES <= TRACE_EEPROM_END,
+	"trace does not fit in EEPROM");
+
+static unsigned char trace_buf[TRACE_BYTES];
+static unsigned char env_buf[TRACE_ENV_BYTES];
+
+static enum {
+	tr_running,
+	tr_triggered,		// taking the post samples
+	tr_frozen,		// waiting for the EEPROM queue
+	tr_writing,		// being written from trace_buf
+} tr_state;
+
+static unsigned char tr_period = 1;
+static unsigned char tr_post = TRACE_SAMPLES / 2;
+static unsigned char tr_event;		// event code that triggers, 0: none
+static unsigned char tr_ticks;		// until the next sample
+static unsigned char tr_insert;		// next sample to write
+static unsigned char tr_n;		// samples in the ring
+static unsigned char tr_left;		// post samples still to take
+
+static unsigned int env_ticks = TRACE_ENV_TICKS;
+static unsigned int env_count;		// ticks in the open bucket
+static unsigned int env_min[TRACE_CHANNELS];
+static unsigned int env_max[TRACE_CHANNELS];
+static unsigned long env_sum[TRACE_CHANNELS];
+static unsigned char env_insert;	// next bucket to write
+static unsigned char env_n;		// buckets in the ring
+
+static struct trace_hdr tr_hdr;		// cause, then being written by eeprom_queue
+
+static int sd_sent = -1;		// bytes written to the SD file, -1 when not writing
+static int dump_line = -1;		// console tracedump
 
-#ifdef TRACE
-
-#define	TRACE_SIZE	100	// must fit in an unsigned char
-#define	TRACE_POST	50
-
-static int trace_buffer[TRACE_SIZE];
+/*
+ * Store value k of a ring.
+ */
+static void tr_put(unsigned char *ring, unsigned int k, unsigned int v)
+{
+	unsigned char *b = ring + (k >> 1) * 3;
+
+	if (v > TRACE_MAX)
+		v = TRACE_MAX;
+	if (k & 1) {
+		b[1] = (b[1] & 0x0f) | (v << 4);
+		b[2] = v >> 4;
+	} else {
+		b[0] = v;
+		b[1] = (b[1] & 0xf0) | (v >> 8);
+	}
+}
 
-static unsigned char n_points;
-static unsigned char trigger;
-static unsigned char insert;
-static bool enabled;
-static bool triggered;
+/*
+ * Value k of a ring in EEPROM at addr.
+ */
+static unsigned int tr_get(int addr, unsigned int k)
+{
+	int a = addr + (k >> 1) * 3;
 
+	if (k & 1)
+		return EEPROM.read(a + 1) >> 4 | (unsigned int)EEPROM.read(a + 2) << 4;
+	return EEPROM.read(a) | (unsigned int)(EEPROM.read(a + 1) & 0x0f) << 8;
+}
 
 /*
- * Initialize the trace system.
+ * Start the rings over, empty.
  */
 void trace_init()
 {
-	enabled = true;
-	triggered = false;
-	n_points = 0;
-	insert = 0;
+	tr_state = tr_running;
+	tr_ticks = 1;
+	tr_insert = 0;
+	tr_n = 0;
+	env_count = 0;
+	env_insert = 0;
+	env_n = 0;
 }
 
+/*
+ * Close the open envelope bucket.
+ */
+static void env_close()
+{
+	unsigned int k;
+	unsigned char c;
+
+	if (env_count == 0)
+		return;
+	k = env_insert * TRACE_CHANNELS * 3;
+	for (c = 0; c < TRACE_CHANNELS; c++) {
+		tr_put(env_buf, k++, env_min[c]);
+		tr_put(env_buf, k++, (env_sum[c] + env_count / 2) / env_count);
+		tr_put(env_buf, k++, env_max[c]);
+	}
+	if (++env_insert == TRACE_ENV_BUCKETS)
+		env_insert = 0;
+	if (env_n < TRACE_ENV_BUCKETS)
+		env_n++;
+	env_count = 0;
+}
 
-void trace_trigger()
+static void env_add(const unsigned int *v)
 {
-	triggered = true;
-	trigger = insert;
+	unsigned char c;
+
+	for (c = 0; c < TRACE_CHANNELS; c++) {
+		if (env_count == 0) {
+			env_min[c] = env_max[c] = v[c];
+			env_sum[c] = 0;
+		} else if (v[c] < env_min[c])
+			env_min[c] = v[c];
+		else if (v[c] > env_max[c])
+			env_max[c] = v[c];
+		env_sum[c] += v[c];
+	}
+	if (++env_count == env_ticks)
+		env_close();
 }
 
+static void tr_freeze()
+{
+	env_close();
+	tr_state = tr_frozen;
+}
+
+/*
+ * Trigger the trace.  Only the first trigger counts until the ring is
+ * running again.
+ */
+void trace_trigger(unsigned char cause)
+{
+	if (tr_state != tr_running)
+		return;
+	tr_hdr.cause = cause;
+	tr_left = tr_post;
+	if (tr_post)
+		tr_state = tr_triggered;
+	else
+		tr_freeze();
+}
+
+/*
+ * Called with each event recorded.
+ */
+void trace_event(unsigned char code)
+{
+	if (code != 0 && code == tr_event)
+		trace_trigger(code);
+}
+
+/*
+ * False while taking samples after a trigger.
+ */
 bool trace_done()
 {
-	return !enabled;
+	return tr_state != tr_triggered;
 }
 
-void trace_point(int data)
+/*
+ * Called from the control step, after read_inputs().
+ */
+void trace_step()
 {
-	unsigned char delta;
+	unsigned int v[TRACE_CHANNELS];
+	unsigned int k;
+	unsigned char c;
 
-	if (!enabled)
+	if (tr_state >= tr_frozen)
 		return;
-	
-	// record the data
-	trace_buffer[insert++] = data;
-	if (n_points < TRACE_SIZE)
-		n_points++;
-	else if (insert >= TRACE_SIZE)
-		insert = 0;
-
-	// if we are triggered, stop after awhile
-	if (!triggered)
+	v[0] = i_ig_pressure->filter_a;
+	v[1] = i_main_press->filter_a;
+	v[2] = i_power_sense->filter_a;
+	env_add(v);
+
+	if (--tr_ticks != 0)
 		return;
+	tr_ticks = tr_period;
+
+	k = tr_insert * TRACE_CHANNELS;
+	for (c = 0; c < TRACE_CHANNELS; c++)
+		tr_put(trace_buf, k + c, v[c]);
+	if (++tr_insert == TRACE_SAMPLES)
+		tr_insert = 0;
+	if (tr_n < TRACE_SAMPLES)
+		tr_n++;
+
+	if (tr_state == tr_triggered && --tr_left == 0)
+		tr_freeze();
+}
 
-	if (insert >= trigger)
-		delta = insert - trigger;
-	else {
-		delta = TRACE_SIZE - trigger;
-		delta += insert;
+/*
+ * Queue the frozen trace for EEPROM: the rings, then the header, so a
+ * torn write leaves a header whose CRC does not match.
+ * The caller makes sure the EEPROM is not being written.
+ */
+static void trace_commit()
+{
+	uint16_t seqn;
+
+	EEPROM.get(EEPROM_DATA_TRACE + offsetof(struct trace_hdr, seqn), seqn);
+	tr_hdr.seqn = seqn + 1;
+	tr_hdr.period = tr_period;
+	tr_hdr.post = tr_post;
+	tr_hdr.n = tr_n;
+	tr_hdr.first = (tr_n < TRACE_SAMPLES)? 0: tr_insert;
+	tr_hdr.env_n = env_n;
+	tr_hdr.env_ticks = env_ticks;
+	tr_hdr.env_first = (env_n < TRACE_ENV_BUCKETS)? 0: env_insert;
+	tr_hdr.spare = 0;
+	tr_hdr.crc = crc16(crc16(crc16(CRC16_INIT, &tr_hdr, TRACE_CRC_BYTES),
+		trace_buf, TRACE_BYTES), env_buf, TRACE_ENV_BYTES);
+
+	console.print(F("Writing trace "));
+	console.print(tr_hdr.seqn);
+	console.println(F(" to EEPROM"));
+	eeq_write(EEPROM_DATA_TRACE + sizeof (tr_hdr), trace_buf, TRACE_BYTES);
+	eeq_write(TRACE_ENV_AT, env_buf, TRACE_ENV_BYTES);
+	eeq_write(EEPROM_DATA_TRACE, &tr_hdr, sizeof (tr_hdr));
+	sd_sent = sdl_file()? 0: -1;
+}
+
+/*
+ * Write the next TM_TRACE frame to the SD file, if there is room.  The
+ * data is the trace as it goes to EEPROM.
+ */
+static void trace_sd_frame()
+{
+	unsigned char body[TM_BODY_MAX];
+	unsigned char n, k;
+	unsigned int at;
+
+	if (!sdl_file()) {
+		sd_sent = -1;
+		return;
+	}
+	if (sdl_room() < TM_WIRE_MAX)
+		return;
+	n = 0;
+	body[n++] = TM_TRACE;
+	body[n++] = tr_hdr.seqn;
+	body[n++] = tr_hdr.seqn >> 8;
+	body[n++] = sd_sent;
+	body[n++] = sd_sent >> 8;
+	for (k = 0; k < TRACE_SD_CHUNK && sd_sent + k < TRACE_IMAGE; k++) {
+		at = sd_sent + k;
+		if (at < sizeof (tr_hdr))
+			body[n++] = ((const unsigned char *)&tr_hdr)[at];
+		else if (at < sizeof (tr_hdr) + TRACE_BYTES)
+			body[n++] = trace_buf[at - sizeof (tr_hdr)];
+		else
+			body[n++] = env_buf[at - sizeof (tr_hdr) - TRACE_BYTES];
+	}
+	if (!sdl_frame(body, n))
+		return;
+	sd_sent += k;
+	if (sd_sent >= TRACE_IMAGE)
+		sd_sent = -1;
+}
+
+/*
+ * Called from loop() on every pass.
+ */
+void trace_run()
+{
+	switch (tr_state) {
+	    case tr_frozen:
+		if (eeq_idle()) {
+			trace_commit();
+			tr_state = tr_writing;
+		}
+		break;
+	    case tr_writing:
+		if (sd_sent >= 0)
+			trace_sd_frame();
+		if (eeq_idle() && sd_sent < 0)
+			trace_init();
+		break;
 	}
-	if (delta >= TRACE_POST)
-		enabled = false;
+
+	if (dump_line < 0 || !eeq_idle() || console_bulk.availableForWrite() < SQ_LINE)
+		return;
+	if (trace_to_serial(dump_line)) {
+		dump_line = -1;
+		console_bulk.println("Done printing trace");
+	} else
+		dump_line++;
 }
 
+void trace_cmd(const char *what, const char *val)
+{
+	static const char * const state_str[] = {"running", "triggered", "frozen", "writing"};
+	int v;
+
+	if (what == NULL) {
+		console.print(F("Trace "));
+		console.print(state_str[tr_state]);
+		console.print(F(", "));
+		console.print(tr_n);
+		console.print(F(" of "));
+		console.print(TRACE_SAMPLES);
+		console.print(F(" samples every "));
+		console.print(tr_period);
+		console.print(F(" ticks, "));
+		console.print(tr_post);
+		console.print(F(" after the trigger, event "));
+		console.println(tr_event);
+		console.print(F("Envelope "));
+		console.print(env_n);
+		console.print(F(" of "));
+		console.print(TRACE_ENV_BUCKETS);
+		console.print(F(" buckets of "));
+		console.print(env_ticks);
+		console.println(F(" ticks"));
+		return;
+	}
+	v = (val == NULL)? -1: atoi(val);
+	if (strcmp(what, "period") == 0 && v >= 1 && v <= 255) {
+		tr_period = v;
+		if (tr_state == tr_running)
+			trace_init();	// don't mix sample periods
+	} else if (strcmp(what, "post") == 0 && v >= 0 && v < TRACE_SAMPLES)
+		tr_post = v;
+	else if (strcmp(what, "event") == 0 && v >= 0 && v < 0x40)
+		tr_event = v;
+	else if (strcmp(what, "env") == 0 && val != NULL && atol(val) >= 1 && atol(val) <= 0xffff) {
+		env_ticks = atol(val);
+		if (tr_state == tr_running)
+			trace_init();
+	} else
+		console.println(F("trace [period <1-255> | post <n> | event <code> | env <ticks>]"));
+}
 
 /*
- * Write the trace to EEPROM
- * Returns the trace sequence number
+ * Print the trace in EEPROM on the console, a line per loop() pass.
  */
-unsigned int trace_commit() {
-	unsigned char i;
-	unsigned int seqn;
-
-	if (n_points <= 0 || !triggered)
-		return 0xffff;
-
-	// mark the in-eeprom trace as invalid
-	i = 0;
-	EEPROM.put(EEPROM_TRACE_SIZE_2, i);
-
-	// record the size of the trace buffer
-	EEPROM.put(EEPROM_TRACE_SIZE, n_points);
-	Serial.print("Writing "); Serial.print(n_points); Serial.print(" trace to EEPROM\n");
-	
-	// write the trace data
-	for (i = 0; i < n_points; i++)
-		EEPROM.put(EEPROM_DATA_TRACE + i * sizeof (int),
-				trace_buffer[i]);
-
-	// update the trace seqn number in eeprom
-	EEPROM.get(EEPROM_TRACE_SEQN, seqn);
-	seqn += 1;
-	EEPROM.put(EEPROM_TRACE_SEQN, seqn);
-
-	EEPROM.put(EEPROM_TRACE_SIZE_2, n_points);
-	EEPROM.put(EEPROM_TRACE_TRIGGER, trigger);
-#ifdef TRACE_PIN
-	i = TRACE_PIN;
-#else // TRACE_PIN
-	i = 255;
-#endif // TRACE_PIN
-	EEPROM.put(EEPROM_TRACE_PIN, i);
-	EEPROM.put(EEPROM_TRACE_INSERT, insert);
-
-	triggered = false;	// avoid double calls here.
-
-	return seqn;
+void trace_dump()
+{
+	dump_line = 0;
 }
 
 /*
@@ -130,63 +380,87 @@ unsigned int trace_commit() {
  * Returns true when there are no more lines to print.
  * Caller is responsible for starting _i_ at zero and incrementing it.
  * If it returns true on i=0, then no trace exists.
+ * The caller makes sure the EEPROM is not being written.
+ *
+ * Line 0 is the header, then a line per sample, then the envelope
+ * header and a line per bucket.
  */
+static struct trace_hdr rd_hdr;
 
 bool trace_to_serial(int i) {
-	unsigned char n;
-	unsigned int seqn;
-	int data;
-
-	enabled = false;
+	unsigned int k, c;
+	int a, rel;
+	long ms;
+	uint16_t crc;
 
 	// If i=0, print the header and check valid
 	if (i == 0) {
-		EEPROM.get(EEPROM_TRACE_SIZE, n_points);
-		EEPROM.get(EEPROM_TRACE_SIZE_2, n);
-		if (n != n_points) {
-			Serial.println("No valid trace in EEPROM");
-			n_points = 0;
+		EEPROM.get(EEPROM_DATA_TRACE, rd_hdr);
+		crc = crc16(CRC16_INIT, &rd_hdr, TRACE_CRC_BYTES);
+		for (a = EEPROM_DATA_TRACE + sizeof (rd_hdr); a < TRACE_ENV_AT + TRACE_ENV_BYTES; a++)
+			crc = crc16_update(crc, EEPROM.read(a));
+		if (crc != rd_hdr.crc || rd_hdr.n > TRACE_SAMPLES || rd_hdr.first >= TRACE_SAMPLES ||
+		    rd_hdr.env_n > TRACE_ENV_BUCKETS || rd_hdr.env_first >= TRACE_ENV_BUCKETS) {
+			console_bulk.println("No valid trace in EEPROM");
 			return true;
 		}
 
-		EEPROM.get(EEPROM_TRACE_INSERT, insert);
-		EEPROM.get(EEPROM_TRACE_TRIGGER, trigger);
-		EEPROM.get(EEPROM_TRACE_SEQN, seqn);
-		EEPROM.get(EEPROM_TRACE_PIN, n);
-		
-		Serial.print("Data Trace #: ");
-		Serial.print(seqn);
-		Serial.print(" of pin ");
-		Serial.print(n);
-		Serial.print(" has ");
-		Serial.print(n_points);
-		Serial.print(" data points\n");
+		console_bulk.print("Data Trace #: ");
+		console_bulk.print(rd_hdr.seqn);
+		if (rd_hdr.cause & TRACE_CAUSE_ERROR) {
+			console_bulk.print(", error ");
+			console_bulk.print(rd_hdr.cause & ~TRACE_CAUSE_ERROR);
+		} else {
+			console_bulk.print(", event ");
+			console_bulk.print(rd_hdr.cause);
+		}
+		console_bulk.print(", ");
+		console_bulk.print(rd_hdr.n);
+		console_bulk.print(" samples every ");
+		console_bulk.print((unsigned long)rd_hdr.period * CONTROL_TICK_US);
+		console_bulk.println(" us: ig main power");
 		return false;
 	}
 	i -= 1;
 
-	// If done, reinitialize trace buffer and tell out loop we are done.
-	if (i < 0 || i >= n_points || i >= TRACE_SIZE) {
-		trace_init();
-		return true;
-	}
-
-	// else print a trace data point
-
-	// Deal with wrap-around ring-buffer stuff
-	//i += (int)insert;
-	i = i + insert;
-	if (i >= n_points)
-		i -= n_points;
-
-	if (i == trigger)
-		Serial.print("*** ");
-	else
-		Serial.print("    ");
+	if (i >= rd_hdr.n) {
+		i -= rd_hdr.n;
+		if (i == 0) {
+			console_bulk.print("Envelope: ");
+			console_bulk.print(rd_hdr.env_n);
+			console_bulk.print(" buckets of ");
+			console_bulk.print((unsigned long)rd_hdr.env_ticks * CONTROL_TICK_US / 1000);
+			console_bulk.println(" ms, start in ms before the freeze: ig, main, power min/mean/max");
+			return false;
+		}
+		i -= 1;
+		if (i >= rd_hdr.env_n)
+			return true;
 
-	EEPROM.get(EEPROM_DATA_TRACE + i * sizeof (int), data);
-	Serial.println(data);
+		// the last bucket may be short; times are whole buckets back
+		ms = -(long)(rd_hdr.env_n - i) * rd_hdr.env_ticks * CONTROL_TICK_US / 1000;
+		console_bulk.print(ms);
+		k = ((rd_hdr.env_first + i) % TRACE_ENV_BUCKETS) * TRACE_CHANNELS * 3;
+		for (c = 0; c < TRACE_CHANNELS * 3; c++) {
+			console_bulk.print((c % 3)? "/": "  ");
+			console_bulk.print(tr_get(TRACE_ENV_AT, k + c));
+		}
+		console_bulk.println();
+		return false;
+	}
 
+	// sample number relative to the trigger
+	rel = i - (rd_hdr.n - 1 - rd_hdr.post);
+	console_bulk.print(rel == 0? "*** ": "    ");
+	if (rel > 0)
+		console_bulk.print("+");
+	console_bulk.print(rel);
+
+	k = ((rd_hdr.first + i) % TRACE_SAMPLES) * TRACE_CHANNELS;
+	for (c = 0; c < TRACE_CHANNELS; c++) {
+		console_bulk.print(" ");
+		console_bulk.print(tr_get(EEPROM_DATA_TRACE + sizeof (rd_hdr), k + c));
+	}
+	console_bulk.println();
 	return false;
 }
-#endif
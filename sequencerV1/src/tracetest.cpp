@@ -11,10 +11,10 @@
 #include "errors.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
 
-#ifdef TRACE
+#ifdef TRACE_TEST
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 static void traceTestEnter();
@@ -23,6 +23,7 @@ struct state traceTest = { "traceTest", &traceTestEnter, NULL, &traceTestCheck};
 
 // local state of inputs.  Used to optimize display
 static unsigned char was_safe;
+static unsigned char push_1_edges;	// edge cursor on button 1
 
 /*
  * Want both switches to safe.
@@ -81,7 +82,7 @@ void traceTestEnter()
 	tft.setCursor(20, 3 * TM_TXT_HEIGHT+16+TM_TXT_OFFSET);
 	tft.print(F("running"));
 
-	i_push_1->edge = no_edge;
+	edge_skip(i_push_1, &push_1_edges);
 	was_safe = 0;
 }
 
@@ -101,8 +102,7 @@ const struct state * traceTestCheck()
 	if (!safe_ok())
 		return current_state;
 
-	if (i_push_1->edge == rising) {
-		i_push_1->edge = no_edge;
+	if (edge_rose(i_push_1, &push_1_edges, NULL)) {
 		return error_state(errorIgTestAborted);
 	}
 
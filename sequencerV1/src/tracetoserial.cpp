@@ -10,10 +10,11 @@
 #include "trace.h"
 #include <Adafruit_GFX.h>    // Core graphics library
 #include <Adafruit_ST7735.h> // Hardware-specific library
+#include "tft_queue.h"
+#include "serial_queue.h"
+#include "eeprom_queue.h"
 
-#ifdef TRACE
 
-extern Adafruit_ST7735 tft;
 extern struct menu main_menu;
 
 static void traceDumpEnter();
@@ -25,6 +26,7 @@ static unsigned char was_safe;
 static bool running;
 static bool was_running;
 static int trace_line;
+static unsigned char push_1_edges;	// edge cursor on button 1
 
 /*
  * Want both switches to safe.
@@ -94,7 +96,7 @@ void traceDumpEnter()
 	was_running = true;
 
 	trace_line = 0;
-	i_push_1->edge = no_edge;
+	edge_skip(i_push_1, &push_1_edges);
 	was_safe = 0;
 }
 
@@ -114,19 +116,19 @@ const struct state * traceDumpCheck()
 	if (!safe_ok())
 		return current_state;
 
-	if (i_push_1->edge == rising) {
-		i_push_1->edge = no_edge;
+	if (edge_rose(i_push_1, &push_1_edges, NULL)) {
 		running = !running;
 	}
 
-	if (running) {
+	// one line per pass, when the queue has room for it and the
+	// EEPROM is not being written
+	if (running && eeq_idle() && console_bulk.availableForWrite() >= SQ_LINE) {
 		if (trace_to_serial(trace_line)) {
 			running = false;
-			Serial.println("Done printing trace");
+			console_bulk.println("Done printing trace");
 		} else
 			trace_line += 1;
 	}
 
 	return current_state;
 }
-#endif